@@ -9,6 +9,7 @@
 #endif
 
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
 #include <cctype>
 #include <utility>
@@ -18,6 +19,15 @@
 #include <limits>
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <shared_mutex>
+#include <unordered_map>
+#include <initializer_list>
+#include <new>
+#include <chrono>
 
 #if SUTILS_CPP_VERSION >= 201703L
   #include <string_view>
@@ -30,6 +40,23 @@
   #define SUTILS_CONSTEXPR_DTOR
 #endif
 
+// define SUTILS_NO_SIMD to force the scalar code paths
+#ifndef SUTILS_NO_SIMD
+  #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #include <emmintrin.h>
+    #define SUTILS_HAS_SSE2
+  #endif
+
+  #if defined(SUTILS_HAS_SSE2) && defined(__SSSE3__)
+    #include <tmmintrin.h>
+    #define SUTILS_HAS_SSSE3
+  #endif
+#endif
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
 
 namespace sutils {
 namespace helpers {
@@ -321,10 +348,420 @@ namespace helpers {
   }
 #endif
 
+  // the str_weak_ref_basic type for TStr, for overloads to drop out when TStr isn't a string
+  template<class TStr>
+  using str_weak_ref_t = decltype(str_weak_ref(std::declval<const TStr &>()));
+
+  template<class TC>
+  constexpr auto char_code(TC cc) noexcept {
+    return static_cast<std::uint32_t>(static_cast<typename std::make_unsigned<TC>::type>(cc));
+  }
+
+  // index of the lowest set bit, mask must not be 0
+  inline unsigned lowest_bit(std::uint32_t mask) noexcept {
+#if defined(_MSC_VER)
+    unsigned long idx = 0;
+    _BitScanForward(&idx, mask);
+    return static_cast<unsigned>(idx);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+  }
+
+  // builds a copy of hstr with every match replaced, places are in the order find_all() returns them
+  template<class TC, class TPlaces>
+  auto replace_places(const str_weak_ref_basic<TC> &hstr, const TPlaces &places, size_t search_len, const str_weak_ref_basic<TC> &hreplace, bool backward) {
+    if (places.empty()) {
+      return std::basic_string<TC>(hstr.data(), hstr.size());
+    }
+
+    size_t total_count = hstr.size() - places.size() * search_len + places.size() * hreplace.size();
+    
+    std::basic_string<TC> result{};
+    result.reserve(total_count + 1); // +1 for null
+    size_t start = 0;
+    if (backward) {
+      for (size_t idx = places.size(); idx > 0; --idx) {
+        size_t offset = places[idx - 1];
+        const auto original_length = offset - start;
+        const auto original = hstr.substr(start, original_length);
+        result.append(original.data(), original.size())
+              .append(hreplace.data(), hreplace.size());
+        start = offset + search_len;
+      }
+    } else {
+      for (size_t offset : places) {
+        const auto original_length = offset - start;
+        const auto original = hstr.substr(start, original_length);
+        result.append(original.data(), original.size())
+              .append(hreplace.data(), hreplace.size());
+        start = offset + search_len;
+      }
+    }
+    // copy remaining chars after last match
+    const auto original = hstr.substr(start);
+    result.append(original.data(), original.size());
+
+    return result;
+  }
+
+  // calls fn(token) for every token between the splitters, places are in the order find_all() returns them
+  template<class TC, class TPlaces, class TFn>
+  void split_places(const str_weak_ref_basic<TC> &hstr, const TPlaces &places, size_t splitter_len, bool keep_empty, bool backward, TFn &&fn) {
+    size_t start = 0;
+    if (backward) {
+      for (size_t idx = places.size(); idx > 0; --idx) {
+        size_t offset = places[idx - 1];
+        const auto token_len = offset - start;
+        if (token_len > 0 || keep_empty) {
+          fn(hstr.substr(start, token_len));
+        }
+        start = offset + splitter_len;
+      }
+    } else {
+      for (size_t offset : places) {
+        const auto token_len = offset - start;
+        if (token_len > 0 || keep_empty) {
+          fn(hstr.substr(start, token_len));
+        }
+        start = offset + splitter_len;
+      }
+    }
+    // add last/remaining part of the string (after last splitter)
+    const auto token_len = hstr.size() - start;
+    if (token_len > 0 || keep_empty) {
+      fn(hstr.substr(start, token_len));
+    }
+  }
+
 } // helpers
 } // sutils
 
 
+namespace sutils {
+  // vector with storage for N elements inline, only allocates when it grows beyond that
+  template<class T, size_t N>
+  class small_vector {
+  public:
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using pointer = value_type*;
+    using const_pointer = const value_type*;
+    using iterator = pointer;
+    using const_iterator = const_pointer;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    static constexpr size_type inline_capacity = N;
+
+  private:
+    // N may be 0, keep at least 1 slot to have a valid array
+    alignas(T) unsigned char m_inline[(N > 0 ? N : 1) * sizeof(T)];
+    pointer m_data;
+    size_type m_size;
+    size_type m_capacity;
+
+    pointer inline_data() noexcept {
+      return reinterpret_cast<pointer>(m_inline);
+    }
+
+    void destroy_all() noexcept {
+      for (size_type idx = 0; idx < m_size; ++idx) {
+        m_data[idx].~T();
+      }
+      m_size = 0;
+    }
+
+    void release() noexcept {
+      destroy_all();
+      if (!is_inline()) {
+        ::operator delete(static_cast<void *>(m_data));
+        m_data = inline_data();
+        m_capacity = N;
+      }
+    }
+
+    // destroys the elements built in [first, last) of a new buffer and optionally frees it, unless dismissed
+    struct buffer_guard {
+      pointer data;
+      size_type first;
+      size_type last;
+      bool free_data;
+      bool owned;
+
+      ~buffer_guard() {
+        if (owned) {
+          for (auto idx = first; idx < last; ++idx) {
+            data[idx].~T();
+          }
+          if (free_data) {
+            ::operator delete(static_cast<void *>(data));
+          }
+        }
+      }
+    };
+
+    size_type grown_capacity(size_type min_capacity) const noexcept {
+      return (m_capacity * 2 < min_capacity) ? min_capacity : m_capacity * 2;
+    }
+
+    // moves (or copies, when moving can throw) the elements into dst,
+    // if one of them throws the ones already built are destroyed and *this is untouched
+    void build_into(pointer dst) {
+      buffer_guard guard{ dst, 0, 0, false, true };
+      for (; guard.last < m_size; ++guard.last) {
+        ::new (static_cast<void *>(dst + guard.last)) T(std::move_if_noexcept(m_data[guard.last]));
+      }
+      guard.owned = false;
+    }
+
+    // the old elements are destroyed only once all of them were built in new_data
+    void adopt(pointer new_data, size_type new_capacity) noexcept {
+      for (size_type idx = 0; idx < m_size; ++idx) {
+        m_data[idx].~T();
+      }
+      if (!is_inline()) {
+        ::operator delete(static_cast<void *>(m_data));
+      }
+      m_data = new_data;
+      m_capacity = new_capacity;
+    }
+
+    void grow(size_type min_capacity) {
+      const auto new_capacity = grown_capacity(min_capacity);
+      const auto new_data = static_cast<pointer>(::operator new(new_capacity * sizeof(T)));
+      buffer_guard guard{ new_data, 0, 0, true, true };
+      build_into(new_data);
+      guard.owned = false;
+      adopt(new_data, new_capacity);
+    }
+
+    // the new element is built before the others move, args may refer to one of them
+    template<class... TArgs>
+    void grow_emplace(TArgs&&... args) {
+      const auto new_capacity = grown_capacity(m_size + 1);
+      const auto new_data = static_cast<pointer>(::operator new(new_capacity * sizeof(T)));
+      buffer_guard guard{ new_data, m_size, m_size, true, true };
+      ::new (static_cast<void *>(new_data + m_size)) T(std::forward<TArgs>(args)...);
+      ++guard.last;
+      build_into(new_data);
+      guard.owned = false;
+      adopt(new_data, new_capacity);
+    }
+
+    // steals the heap buffer or moves the inline elements, *this must be empty and inline,
+    // if a move throws the elements already moved are destroyed and *this stays empty
+    void take(small_vector &other) noexcept(std::is_nothrow_move_constructible<T>::value) {
+      if (other.is_inline()) {
+        buffer_guard guard{ m_data, 0, 0, false, true };
+        for (; guard.last < other.m_size; ++guard.last) {
+          ::new (static_cast<void *>(m_data + guard.last)) T(std::move(other.m_data[guard.last]));
+        }
+        guard.owned = false;
+        m_size = other.m_size;
+        other.destroy_all();
+      } else {
+        m_data = other.m_data;
+        m_size = other.m_size;
+        m_capacity = other.m_capacity;
+        other.m_data = other.inline_data();
+        other.m_size = 0;
+        other.m_capacity = N;
+      }
+    }
+
+  public:
+    small_vector() noexcept :
+      m_data(inline_data()),
+      m_size(0),
+      m_capacity(N)
+    { }
+
+    small_vector(std::initializer_list<value_type> items) :
+      small_vector()
+    {
+      reserve(items.size());
+      for (const auto &item : items) {
+        push_back(item);
+      }
+    }
+
+    small_vector(const small_vector &other) :
+      small_vector()
+    {
+      reserve(other.m_size);
+      for (const auto &item : other) {
+        push_back(item);
+      }
+    }
+
+    small_vector(small_vector &&other) noexcept(std::is_nothrow_move_constructible<T>::value) :
+      small_vector()
+    {
+      take(other);
+    }
+
+    small_vector& operator=(const small_vector &other) {
+      if (this != &other) {
+        clear();
+        reserve(other.m_size);
+        for (const auto &item : other) {
+          push_back(item);
+        }
+      }
+      return *this;
+    }
+
+    small_vector& operator=(small_vector &&other) noexcept(std::is_nothrow_move_constructible<T>::value) {
+      if (this != &other) {
+        release();
+        take(other);
+      }
+      return *this;
+    }
+
+    ~small_vector() {
+      release();
+    }
+
+    bool is_inline() const noexcept {
+      return m_data == reinterpret_cast<const_pointer>(m_inline);
+    }
+
+    size_type size() const noexcept {
+      return m_size;
+    }
+
+    size_type capacity() const noexcept {
+      return m_capacity;
+    }
+
+    bool empty() const noexcept {
+      return m_size == 0;
+    }
+
+    pointer data() noexcept {
+      return m_data;
+    }
+
+    const_pointer data() const noexcept {
+      return m_data;
+    }
+
+    reference operator[](size_type idx) noexcept {
+      return m_data[idx];
+    }
+
+    const_reference operator[](size_type idx) const noexcept {
+      return m_data[idx];
+    }
+
+    reference front() noexcept {
+      return m_data[0];
+    }
+
+    const_reference front() const noexcept {
+      return m_data[0];
+    }
+
+    reference back() noexcept {
+      return m_data[m_size - 1];
+    }
+
+    const_reference back() const noexcept {
+      return m_data[m_size - 1];
+    }
+
+    iterator begin() noexcept {
+      return m_data;
+    }
+
+    const_iterator begin() const noexcept {
+      return m_data;
+    }
+
+    iterator end() noexcept {
+      return m_data + m_size;
+    }
+
+    const_iterator end() const noexcept {
+      return m_data + m_size;
+    }
+
+    const_iterator cbegin() const noexcept {
+      return begin();
+    }
+
+    const_iterator cend() const noexcept {
+      return end();
+    }
+
+    reverse_iterator rbegin() noexcept {
+      return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const noexcept {
+      return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() noexcept {
+      return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const noexcept {
+      return const_reverse_iterator(begin());
+    }
+
+    void reserve(size_type new_capacity) {
+      if (new_capacity > m_capacity) {
+        grow(new_capacity);
+      }
+    }
+
+    template<class... TArgs>
+    reference emplace_back(TArgs&&... args) {
+      if (m_size == m_capacity) {
+        grow_emplace(std::forward<TArgs>(args)...);
+      } else {
+        ::new (static_cast<void *>(m_data + m_size)) T(std::forward<TArgs>(args)...);
+      }
+      return m_data[m_size++];
+    }
+
+    void push_back(const value_type &item) {
+      emplace_back(item);
+    }
+
+    void push_back(value_type &&item) {
+      emplace_back(std::move(item));
+    }
+
+    void pop_back() noexcept {
+      --m_size;
+      m_data[m_size].~T();
+    }
+
+    // keeps the capacity
+    void clear() noexcept {
+      destroy_all();
+    }
+  };
+
+  template<class T, size_t N1, size_t N2>
+  bool operator==(const small_vector<T, N1> &left, const small_vector<T, N2> &right) {
+    return std::equal(left.begin(), left.end(), right.begin(), right.end());
+  }
+
+  template<class T, size_t N1, size_t N2>
+  bool operator!=(const small_vector<T, N1> &left, const small_vector<T, N2> &right) {
+    return !( left == right );
+  }
+}
+
+
 namespace sutils {
   template<class TC, bool reverse = false>
   bool cmp(
@@ -345,8 +782,109 @@ namespace sutils {
     }
   }
 
-  template<class TStr1, class TStr2>
-  bool cmp(const TStr1 &s1, const TStr2 &s2, bool case_insensitive = false) {
+  // compile time flags for the policy overloads, e.g. sutils::find_all<sutils::policy::icase | sutils::policy::reverse>(str, "ab"),
+  // each combination gets its own specialized code without the runtime flags branches
+  enum class search_policy : unsigned {
+    none = 0,
+    icase = 1u << 0, // same as case_insensitive = true
+    reverse = 1u << 1, // same as backward = true, for cmp(), starts() and ends() the chars are compared from the last one
+  };
+
+  constexpr search_policy operator|(search_policy left, search_policy right) noexcept {
+    return static_cast<search_policy>(static_cast<unsigned>(left) | static_cast<unsigned>(right));
+  }
+
+  // short names in their own namespace, so "using namespace sutils;" can't make std::reverse ambiguous
+namespace policy {
+  constexpr search_policy none = search_policy::none;
+  constexpr search_policy icase = search_policy::icase;
+  constexpr search_policy reverse = search_policy::reverse;
+} // policy
+
+namespace helpers {
+  constexpr bool has_policy(search_policy policy, search_policy flag) noexcept {
+    return (static_cast<unsigned>(policy) & static_cast<unsigned>(flag)) != 0;
+  }
+
+  // calls fn(std::integral_constant<search_policy, P>{}) with P made of the runtime flags,
+  // the runtime overloads are thin wrappers over the policy ones this way
+  template<class TFn>
+  decltype(auto) with_policy(bool case_insensitive, bool backward, TFn &&fn) {
+    if (case_insensitive) {
+      if (backward) {
+        return fn(std::integral_constant<search_policy, search_policy::icase | search_policy::reverse>{});
+      }
+      return fn(std::integral_constant<search_policy, search_policy::icase>{});
+    }
+
+    if (backward) {
+      return fn(std::integral_constant<search_policy, search_policy::reverse>{});
+    }
+    return fn(std::integral_constant<search_policy, search_policy::none>{});
+  }
+
+  // chars considered equal by cmp() have the same key
+  template<bool case_insensitive, class TC>
+  std::uint32_t case_key(TC cc) noexcept {
+    const auto code = char_code(cc);
+    return (case_insensitive && code < 256) ? static_cast<std::uint32_t>(std::toupper(static_cast<int>(code))) : code;
+  }
+
+  template<class TC>
+  std::uint32_t case_key(TC cc, bool case_insensitive) noexcept {
+    return case_insensitive ? case_key<true>(cc) : case_key<false>(cc);
+  }
+
+  // compares count chars, starting from the last one when backward
+  template<bool case_insensitive, bool backward, class TC>
+  bool equal_chars(const TC *data1, const TC *data2, size_t count) noexcept {
+    if (!case_insensitive && !backward) {
+      return std::equal(data1, data1 + count, data2);
+    }
+
+    for (size_t idx = 0; idx < count; ++idx) {
+      const auto pos = backward ? count - 1 - idx : idx;
+      if (case_key<case_insensitive>(data1[pos]) != case_key<case_insensitive>(data2[pos])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template<bool case_insensitive, bool backward, class TC, size_t... idx>
+  bool equal_chars_unrolled(const TC *data1, const TC *data2, std::index_sequence<idx...>) noexcept {
+    constexpr size_t count = sizeof...(idx);
+    (void)data1; // unused when count is 0
+    (void)data2;
+    bool equal = true;
+    // braced lists are evaluated in order, the && stops at the first mismatch
+    (void)std::initializer_list<int>{ (equal = equal &&
+      case_key<case_insensitive>(data1[backward ? count - 1 - idx : idx]) == case_key<case_insensitive>(data2[backward ? count - 1 - idx : idx]), 0)... };
+    return equal;
+  }
+
+  // same as above with count known at compile time, short needles get a fully unrolled compare
+  template<bool case_insensitive, bool backward, size_t count, class TC>
+  bool equal_chars(const TC *data1, const TC *data2) noexcept {
+    constexpr size_t max_unrolled = 16;
+    if (count > max_unrolled) {
+      return equal_chars<case_insensitive, backward>(data1, data2, count);
+    }
+    return equal_chars_unrolled<case_insensitive, backward>(data1, data2, std::make_index_sequence<(count > max_unrolled) ? 0 : count>{});
+  }
+
+  // compares the window at data with the needle, fixed_len is the needle length when known at compile time, 0 otherwise
+  template<bool case_insensitive, size_t fixed_len, class TC>
+  bool equal_window(const TC *data, const str_weak_ref_basic<TC> &hsearch) noexcept {
+    if (fixed_len != 0) {
+      return equal_chars<case_insensitive, false, fixed_len>(data, hsearch.data());
+    }
+    return equal_chars<case_insensitive, false>(data, hsearch.data(), hsearch.size());
+  }
+} // helpers
+
+  template<search_policy policy, class TStr1, class TStr2>
+  bool cmp(const TStr1 &s1, const TStr2 &s2) noexcept {
     const auto hs1 = helpers::str_weak_ref(s1);
     const auto hs2 = helpers::str_weak_ref(s2);
 
@@ -355,11 +893,12 @@ namespace sutils {
 
     static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
 
-    return cmp<TC1, false>(hs1.begin(), hs1.end(), hs2.begin(), hs2.end(), case_insensitive);
+    return (hs1.size() == hs2.size()) &&
+      helpers::equal_chars<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse)>(hs1.data(), hs2.data(), hs1.size());
   }
 
-  template<class TStr1, class TStr2>
-  bool starts(const TStr1 &str, const TStr2 &search, bool case_insensitive = false) {
+  template<search_policy policy, class TStr1, class TStr2>
+  bool starts(const TStr1 &str, const TStr2 &search) noexcept {
     const auto hstr = helpers::str_weak_ref(str);
     const auto hsearch = helpers::str_weak_ref(search);
 
@@ -375,12 +914,12 @@ namespace sutils {
       return false;
     }
 
-    auto hstr_begin = hstr.begin();
-    return cmp<TC1>(hstr_begin, hstr_begin + hsearch.size(), hsearch.begin(), hsearch.end(), case_insensitive);
+    return (hstr.size() >= hsearch.size()) &&
+      helpers::equal_chars<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse)>(hstr.data(), hsearch.data(), hsearch.size());
   }
 
-  template<class TStr1, class TStr2>
-  bool ends(const TStr1 &str, const TStr2 &search, bool case_insensitive = false) {
+  template<search_policy policy, class TStr1, class TStr2>
+  bool ends(const TStr1 &str, const TStr2 &search) noexcept {
     const auto hstr = helpers::str_weak_ref(str);
     const auto hsearch = helpers::str_weak_ref(search);
 
@@ -396,96 +935,702 @@ namespace sutils {
       return false;
     }
 
-    auto hstr_rbegin = hstr.rbegin();
-    return cmp<TC1, true>(hstr_rbegin, hstr_rbegin + hsearch.size(), hsearch.rbegin(), hsearch.rend(), case_insensitive);
+    return (hstr.size() >= hsearch.size()) &&
+      helpers::equal_chars<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse)>(hstr.data() + (hstr.size() - hsearch.size()), hsearch.data(), hsearch.size());
   }
 
   template<class TStr1, class TStr2>
-  std::vector<size_t> find_all(const TStr1 &str, const TStr2 &search, bool backward = false, size_t max_finds = static_cast<size_t>(-1), bool case_insensitive = false) {
-    const auto hstr = helpers::str_weak_ref(str);
-    const auto hsearch = helpers::str_weak_ref(search);
+  bool cmp(const TStr1 &s1, const TStr2 &s2, bool case_insensitive = false) {
+    return helpers::with_policy(case_insensitive, false, [&](auto policy){
+      return cmp<decltype(policy)::value>(s1, s2);
+    });
+  }
 
-    using TC1 = typename decltype(hstr)::value_type;
-    using TC2 = typename decltype(hsearch)::value_type;
+  template<class TStr1, class TStr2>
+  bool starts(const TStr1 &str, const TStr2 &search, bool case_insensitive = false) {
+    return helpers::with_policy(case_insensitive, false, [&](auto policy){
+      return starts<decltype(policy)::value>(str, search);
+    });
+  }
 
-    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+  template<class TStr1, class TStr2>
+  bool ends(const TStr1 &str, const TStr2 &search, bool case_insensitive = false) {
+    return helpers::with_policy(case_insensitive, false, [&](auto policy){
+      return ends<decltype(policy)::value>(str, search);
+    });
+  }
 
-    if (hstr.empty() || hsearch.empty() || (hstr.size() < hsearch.size()) || (max_finds == 0)) {
-      return {};
-    }
+  // the algorithms find_all() and everything built on it picks from
+  enum class search_kernel {
+    none, // nothing to search for
+    naive, // compare the needle at every offset
+    single_char, // 1 char needle, memchr()
+    pair_filter, // 2 of the rarest needle chars compared 16 offsets at a time (SSE2, 1 byte chars)
+    skip_table, // Horspool bad char shifts, best for long needles
+  };
 
-    std::vector<size_t> results{};
-    if (backward) {
-      for (size_t len = hstr.size(); (len > 0) && (max_finds > 0); --max_finds) {
-        if (ends(hstr.substr(0, len), hsearch, case_insensitive)) {
-          results.emplace_back(len - hsearch.size());
-          len -= hsearch.size();
-        } else {
-          --len;
-        }
-      }
-    } else {
-      for (size_t idx = 0; (idx < hstr.size()) && (max_finds > 0); --max_finds) {
-        if (starts(hstr.substr(idx), hsearch, case_insensitive)) {
-          results.emplace_back(idx);
-          idx += hsearch.size();
-        } else {
-          ++idx;
-        }
-      }
+  inline const char* kernel_name(search_kernel kernel) noexcept {
+    switch (kernel) {
+    case search_kernel::none: return "none";
+    case search_kernel::naive: return "naive";
+    case search_kernel::single_char: return "single_char";
+    case search_kernel::pair_filter: return "pair_filter";
+    case search_kernel::skip_table: return "skip_table";
     }
-    return results;
+    return "unknown";
   }
 
-  template<class TStr1, class TStr2, class TStr3>
-  auto replace_all(const TStr1 &str, const TStr2 &search, const TStr3 &replace, bool backward = false, size_t max_replaces = static_cast<size_t>(-1), bool case_insensitive = false) {
-    const auto hstr = helpers::str_weak_ref(str);
-    const auto hsearch = helpers::str_weak_ref(search);
-    const auto hreplace = helpers::str_weak_ref(replace);
+  // the defaults are reasonable for x86-64, calibrate_kernels() measures them on the host,
+  // except common_byte which depends on the text more than on the host and keeps its value
+  struct kernel_thresholds {
+    size_t pair_filter_max_len = 16; // longest needle for pair_filter
+    size_t skip_table_min_len = 4; // shortest needle for skip_table
+    size_t skip_table_min_str = 64; // shortest string for skip_table, below it building the table dominates
+    unsigned common_byte = 150; // needles whose rarest chars are all at least this common prefer skip_table
+  };
 
-    using TC1 = typename decltype(hstr)::value_type;
-    using TC2 = typename decltype(hsearch)::value_type;
-    using TC3 = typename decltype(hreplace)::value_type;
+namespace helpers {
+  // approximate frequency of every byte in English text and source code,
+  // 0 (never seen) to 255 (most common), codes past the byte range count as rare
+  // a function local table so every translation unit shares one definition
+  inline std::uint8_t byte_frequency(std::uint32_t code) noexcept {
+    static constexpr std::uint8_t table[256] = {
+        1,   1,   1,   1,   1,   1,   1,   1,   1,  90, 150,   1,   1,  70,   1,   1, // 0x0_
+        1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1, // 0x1_
+      255,  35,  95,  30,  15,  20,  30,  90,  85,  85,  50,  40, 135, 100, 140,  75, // 0x2_
+      100,  97,  94,  91,  88,  85,  82,  79,  76,  73,  80,  80,  45,  85,  45,  35, // 0x3_
+       15, 104,  53,  77,  83, 110,  65,  62,  89,  98,  44,  47,  80,  71,  95, 101, // 0x4_
+       56,  38,  86,  92, 107,  74,  50,  68,  41,  59,  35,  40,  25,  40,  10,  90, // 0x5_
+       10, 216,  97, 153, 167, 230, 125, 118, 181, 202,  76,  83, 160, 139, 195, 209, // 0x6_
+      104,  62, 174, 188, 223, 146,  90, 132,  69, 111,  55,  40,  25,  40,  10,   1, // 0x7_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0x8_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0x9_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0xA_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0xB_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0xC_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0xD_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0xE_
+        8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8, // 0xF_
+    };
+    return code < 256 ? table[code] : 0;
+  }
 
-    static_assert(std::is_same<TC1, TC2>::value && std::is_same<TC1, TC3>::value, "mismatching char type");
+  struct kernel_thresholds_storage {
+    std::atomic<size_t> pair_filter_max_len;
+    std::atomic<size_t> skip_table_min_len;
+    std::atomic<size_t> skip_table_min_str;
+    std::atomic<unsigned> common_byte;
+
+    explicit kernel_thresholds_storage(const kernel_thresholds &values) noexcept :
+      pair_filter_max_len(values.pair_filter_max_len),
+      skip_table_min_len(values.skip_table_min_len),
+      skip_table_min_str(values.skip_table_min_str),
+      common_byte(values.common_byte)
+    { }
+  };
 
-    if (max_replaces == 0) {
-      return std::basic_string<TC1>(hstr.data(), hstr.size());
+  inline kernel_thresholds_storage& thresholds_storage() noexcept {
+    static kernel_thresholds_storage storage(kernel_thresholds{});
+    return storage;
+  }
+} // helpers
+
+  inline kernel_thresholds get_kernel_thresholds() noexcept {
+    const auto &storage = helpers::thresholds_storage();
+    kernel_thresholds values{};
+    values.pair_filter_max_len = storage.pair_filter_max_len.load(std::memory_order_relaxed);
+    values.skip_table_min_len = storage.skip_table_min_len.load(std::memory_order_relaxed);
+    values.skip_table_min_str = storage.skip_table_min_str.load(std::memory_order_relaxed);
+    values.common_byte = storage.common_byte.load(std::memory_order_relaxed);
+    return values;
+  }
+
+  // process wide, affects every following search
+  inline void set_kernel_thresholds(const kernel_thresholds &values) noexcept {
+    auto &storage = helpers::thresholds_storage();
+    storage.pair_filter_max_len.store(values.pair_filter_max_len, std::memory_order_relaxed);
+    storage.skip_table_min_len.store(values.skip_table_min_len, std::memory_order_relaxed);
+    storage.skip_table_min_str.store(values.skip_table_min_str, std::memory_order_relaxed);
+    storage.common_byte.store(values.common_byte, std::memory_order_relaxed);
+  }
+
+namespace helpers {
+  // index of the highest set bit, mask must not be 0
+  inline unsigned highest_bit(std::uint32_t mask) noexcept {
+#if defined(_MSC_VER)
+    unsigned long idx = 0;
+    _BitScanReverse(&idx, mask);
+    return static_cast<unsigned>(idx);
+#else
+    return 31u - static_cast<unsigned>(__builtin_clz(mask));
+#endif
+  }
+
+  // picks the 2 rarest offsets of the needle by byte_frequency, first < second unless the needle is 1 char
+  template<class TC>
+  void rare_pair(const str_weak_ref_basic<TC> &hsearch, size_t &first, size_t &second) noexcept {
+    const auto freq = [&hsearch](size_t idx){
+      return byte_frequency(char_code(hsearch.data()[idx]));
+    };
+
+    second = hsearch.size() - 1;
+    for (size_t idx = hsearch.size() - 1; idx > 0; --idx) {
+      if (freq(idx - 1) < freq(second)) {
+        second = idx - 1;
+      }
     }
 
-    const auto all_places = find_all(hstr, hsearch, backward, max_replaces, case_insensitive);
-    if (all_places.empty()) {
-      return std::basic_string<TC1>(hstr.data(), hstr.size());
+    first = (second == 0) ? hsearch.size() - 1 : 0;
+    for (size_t idx = 0; idx < hsearch.size(); ++idx) {
+      if (idx != second && freq(idx) < freq(first)) {
+        first = idx;
+      }
     }
 
-    size_t total_count = hstr.size() - all_places.size() * hsearch.size() + all_places.size() * hreplace.size();
-    
-    std::basic_string<TC1> result{};
-    result.reserve(total_count + 1); // +1 for null
-    size_t start = 0;
+    if (first > second) {
+      std::swap(first, second);
+    }
+  }
+
+  template<class TC>
+  search_kernel select_kernel(size_t str_len, const str_weak_ref_basic<TC> &hsearch, bool case_insensitive) noexcept {
+    const auto len = hsearch.size();
+    if (len == 0 || str_len < len) {
+      return search_kernel::none;
+    }
+
+    if (len == 1 && !case_insensitive) {
+      return search_kernel::single_char;
+    }
+
+    const auto thresholds = get_kernel_thresholds();
+    const bool skip_table_fits = (len >= thresholds.skip_table_min_len) && (str_len >= thresholds.skip_table_min_str);
+#ifdef SUTILS_HAS_SSE2
+    if (sizeof(TC) == 1 && !case_insensitive && len <= thresholds.pair_filter_max_len) {
+      // both filter chars being common makes most offsets a candidate
+      if (skip_table_fits) {
+        size_t first = 0;
+        size_t second = 0;
+        rare_pair(hsearch, first, second);
+        const auto rarest = std::min(byte_frequency(char_code(hsearch.data()[first])), byte_frequency(char_code(hsearch.data()[second])));
+        if (rarest >= thresholds.common_byte) {
+          return search_kernel::skip_table;
+        }
+      }
+      return search_kernel::pair_filter;
+    }
+#endif
+    return skip_table_fits ? search_kernel::skip_table : search_kernel::naive;
+  }
+
+  // the kernels below take fixed_len != 0 when hsearch.size() is a compile time constant
+  template<bool case_insensitive, bool backward, size_t fixed_len = 0, class TC, class TFn>
+  void find_naive(const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, size_t max_finds, TFn &fn) {
+    const size_t len = fixed_len ? fixed_len : hsearch.size();
+    const auto data = hstr.data();
     if (backward) {
-      for (size_t idx = all_places.size(); idx > 0; --idx) {
-        size_t offset = all_places[idx - 1];
-        const auto original_length = offset - start;
-        const auto original = hstr.substr(start, original_length);
-        result.append(original.data(), original.size())
-              .append(hreplace.data(), hreplace.size());
-        start = offset + hsearch.size();
+      for (size_t end = hstr.size(); (end >= len) && (max_finds > 0); ) {
+        if (equal_window<case_insensitive, fixed_len>(data + end - len, hsearch)) {
+          fn(end - len);
+          end -= len;
+          --max_finds;
+        } else {
+          --end;
+        }
       }
     } else {
-      for (size_t offset : all_places) {
-        const auto original_length = offset - start;
-        const auto original = hstr.substr(start, original_length);
-        result.append(original.data(), original.size())
-              .append(hreplace.data(), hreplace.size());
-        start = offset + hsearch.size();
+      for (size_t idx = 0; (idx + len <= hstr.size()) && (max_finds > 0); ) {
+        if (equal_window<case_insensitive, fixed_len>(data + idx, hsearch)) {
+          fn(idx);
+          idx += len;
+          --max_finds;
+        } else {
+          ++idx;
+        }
       }
     }
-    // copy remaining chars after last match
-    const auto original = hstr.substr(start);
-    result.append(original.data(), original.size());
+  }
 
-    return result;
+  template<bool backward, class TC, class TFn>
+  void find_single_char(const str_weak_ref_basic<TC> &hstr, TC cc, size_t max_finds, TFn &fn) {
+    const auto data = hstr.data();
+    if (backward) {
+      for (size_t idx = hstr.size(); (idx > 0) && (max_finds > 0); --idx) {
+        if (data[idx - 1] == cc) {
+          fn(idx - 1);
+          --max_finds;
+        }
+      }
+    } else {
+      const auto count = hstr.size();
+      for (size_t idx = 0; (idx < count) && (max_finds > 0); ++idx) {
+        if (sizeof(TC) == 1) {
+          const auto found = std::memchr(data + idx, static_cast<int>(char_code(cc)), count - idx);
+          if (!found) {
+            return;
+          }
+          idx = static_cast<size_t>(static_cast<const TC *>(found) - data);
+        } else if (data[idx] != cc) {
+          continue;
+        }
+        fn(idx);
+        --max_finds;
+      }
+    }
+  }
+
+  // Horspool bad char shifts, the distance to the last char of the window when searching forward,
+  // or from the first char when searching backward
+  template<bool case_insensitive, bool backward, class TC>
+  void horspool_table(size_t (&shift)[256], const str_weak_ref_basic<TC> &hsearch) noexcept {
+    const auto len = hsearch.size();
+    std::fill(std::begin(shift), std::end(shift), len);
+    if (len == 0) {
+      return;
+    }
+
+    // chars sharing the low byte of their key get the smallest shift
+    if (backward) {
+      for (size_t idx = len - 1; idx > 0; --idx) {
+        shift[case_key<case_insensitive>(hsearch.data()[idx]) & 0xFF] = idx;
+      }
+    } else {
+      for (size_t idx = 0; idx < len - 1; ++idx) {
+        shift[case_key<case_insensitive>(hsearch.data()[idx]) & 0xFF] = len - 1 - idx;
+      }
+    }
+  }
+
+  template<class TC>
+  void horspool_table(size_t (&shift)[256], const str_weak_ref_basic<TC> &hsearch, bool case_insensitive, bool backward) noexcept {
+    with_policy(case_insensitive, backward, [&](auto policy){
+      horspool_table<has_policy(decltype(policy)::value, search_policy::icase), has_policy(decltype(policy)::value, search_policy::reverse)>(shift, hsearch);
+    });
+  }
+
+  template<bool case_insensitive, bool backward, size_t fixed_len = 0, class TC, class TFn>
+  void find_horspool(const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, const size_t (&shift)[256], size_t max_finds, TFn &fn) {
+    const size_t len = fixed_len ? fixed_len : hsearch.size();
+    if (len == 0 || hstr.size() < len || max_finds == 0) {
+      return;
+    }
+
+    const auto data = hstr.data();
+    if (backward) {
+      const auto first_key = case_key<case_insensitive>(hsearch.data()[0]);
+      for (size_t end = hstr.size(); end >= len; ) {
+        const auto start = end - len;
+        const auto key = case_key<case_insensitive>(data[start]);
+        if (key == first_key && equal_window<case_insensitive, fixed_len>(data + start, hsearch)) {
+          fn(start);
+          if (--max_finds == 0) {
+            return;
+          }
+          end = start;
+        } else {
+          const auto step = shift[key & 0xFF];
+          if (step > end) {
+            return;
+          }
+          end -= step;
+        }
+      }
+    } else {
+      const auto last_key = case_key<case_insensitive>(hsearch.data()[len - 1]);
+      for (size_t start = 0; start + len <= hstr.size(); ) {
+        const auto key = case_key<case_insensitive>(data[start + len - 1]);
+        if (key == last_key && equal_window<case_insensitive, fixed_len>(data + start, hsearch)) {
+          fn(start);
+          if (--max_finds == 0) {
+            return;
+          }
+          start += len;
+        } else {
+          start += shift[key & 0xFF];
+        }
+      }
+    }
+  }
+
+  template<class TC, class TFn>
+  void find_horspool(const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, const size_t (&shift)[256], bool backward, size_t max_finds, bool case_insensitive, TFn &fn) {
+    with_policy(case_insensitive, backward, [&](auto policy){
+      find_horspool<has_policy(decltype(policy)::value, search_policy::icase), has_policy(decltype(policy)::value, search_policy::reverse)>(hstr, hsearch, shift, max_finds, fn);
+    });
+  }
+
+#ifdef SUTILS_HAS_SSE2
+  // "SIMD-friendly algorithms for substring searching" by Wojciech Mula, generic SIMD
+  // http://0x80.pl/articles/simd-strfind.html
+  // compares 2 of the rarest needle chars at 16 offsets at a time, only for 1 byte chars
+  template<bool backward, size_t fixed_len = 0, class TC, class TFn>
+  void find_pair_filter(const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, size_t max_finds, TFn &fn) {
+    const size_t len = fixed_len ? fixed_len : hsearch.size();
+    const auto count = hstr.size();
+    const auto data = hstr.data();
+    const auto needle = hsearch.data();
+    size_t first = 0;
+    size_t second = 0;
+    rare_pair(hsearch, first, second);
+
+    const auto is_match = [&](size_t start){
+      return data[start + first] == needle[first] &&
+             data[start + second] == needle[second] &&
+             equal_window<false, fixed_len>(data + start, hsearch);
+    };
+    const auto first_chars = _mm_set1_epi8(static_cast<char>(needle[first]));
+    const auto second_chars = _mm_set1_epi8(static_cast<char>(needle[second]));
+    // bit k is set when the window starting at (base + k) passes the filter
+    const auto candidates = [&](size_t base){
+      const auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + base + first));
+      const auto block_second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + base + second));
+      const auto eq = _mm_and_si128(_mm_cmpeq_epi8(block_first, first_chars), _mm_cmpeq_epi8(block_second, second_chars));
+      return static_cast<std::uint32_t>(_mm_movemask_epi8(eq));
+    };
+
+    if (backward) {
+      size_t end = count;
+      // 16 windows ending at or before end
+      while (end >= len + 15 && max_finds > 0) {
+        const auto base = end - len - 15;
+        auto mask = candidates(base);
+        bool matched = false;
+        while (mask) {
+          const auto bit = highest_bit(mask);
+          mask &= ~(1u << bit);
+          if (is_match(base + bit)) {
+            fn(base + bit);
+            --max_finds;
+            end = base + bit;
+            matched = true;
+            break;
+          }
+        }
+        if (!matched) {
+          end -= 16;
+        }
+      }
+      while (end >= len && max_finds > 0) {
+        if (is_match(end - len)) {
+          fn(end - len);
+          --max_finds;
+          end -= len;
+        } else {
+          --end;
+        }
+      }
+    } else {
+      size_t start = 0;
+      // 16 windows starting at or after start
+      while (start + 15 + len <= count && max_finds > 0) {
+        auto mask = candidates(start);
+        bool matched = false;
+        while (mask) {
+          const auto bit = lowest_bit(mask);
+          mask &= mask - 1;
+          if (is_match(start + bit)) {
+            fn(start + bit);
+            --max_finds;
+            start += bit + len;
+            matched = true;
+            break;
+          }
+        }
+        if (!matched) {
+          start += 16;
+        }
+      }
+      while (start + len <= count && max_finds > 0) {
+        if (is_match(start)) {
+          fn(start);
+          --max_finds;
+          start += len;
+        } else {
+          ++start;
+        }
+      }
+    }
+  }
+#endif
+
+  // calls fn(offset) for every match found with the given kernel,
+  // falls back to the naive kernel when the given one can't handle the needle,
+  // shift must be filled by horspool_table() when the kernel is skip_table,
+  // so searching many strings for the same needle builds the table once
+  template<bool case_insensitive, bool backward, size_t fixed_len = 0, class TC, class TFn>
+  void find_with_table(search_kernel kernel, const size_t (&shift)[256], const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, size_t max_finds, TFn &&fn) {
+    if (hstr.empty() || hsearch.empty() || (hstr.size() < hsearch.size()) || (max_finds == 0)) {
+      return;
+    }
+
+    switch (kernel) {
+    case search_kernel::none:
+      return;
+
+    case search_kernel::single_char:
+      if (hsearch.size() == 1 && !case_insensitive) {
+        find_single_char<backward>(hstr, hsearch.data()[0], max_finds, fn);
+        return;
+      }
+      break;
+
+    case search_kernel::pair_filter:
+#ifdef SUTILS_HAS_SSE2
+      if (sizeof(TC) == 1 && !case_insensitive) {
+        find_pair_filter<backward, fixed_len>(hstr, hsearch, max_finds, fn);
+        return;
+      }
+#endif
+      break;
+
+    case search_kernel::skip_table:
+      find_horspool<case_insensitive, backward, fixed_len>(hstr, hsearch, shift, max_finds, fn);
+      return;
+
+    case search_kernel::naive:
+      break;
+    }
+
+    find_naive<case_insensitive, backward, fixed_len>(hstr, hsearch, max_finds, fn);
+  }
+
+  template<class TC, class TFn>
+  void find_with_table(search_kernel kernel, const size_t (&shift)[256], const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, bool backward, size_t max_finds, bool case_insensitive, TFn &&fn) {
+    with_policy(case_insensitive, backward, [&](auto policy){
+      find_with_table<has_policy(decltype(policy)::value, search_policy::icase), has_policy(decltype(policy)::value, search_policy::reverse)>(kernel, shift, hstr, hsearch, max_finds, fn);
+    });
+  }
+
+  // same as find_with_table(), builds the table itself when needed
+  template<bool case_insensitive, bool backward, size_t fixed_len = 0, class TC, class TFn>
+  void find_with_kernel(search_kernel kernel, const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, size_t max_finds, TFn &&fn) {
+    size_t shift[256];
+    if (kernel == search_kernel::skip_table && !hsearch.empty() && hstr.size() >= hsearch.size() && max_finds > 0) {
+      horspool_table<case_insensitive, backward>(shift, hsearch);
+    }
+    find_with_table<case_insensitive, backward, fixed_len>(kernel, shift, hstr, hsearch, max_finds, fn);
+  }
+
+  template<class TC, class TFn>
+  void find_with_kernel(search_kernel kernel, const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, bool backward, size_t max_finds, bool case_insensitive, TFn &&fn) {
+    with_policy(case_insensitive, backward, [&](auto policy){
+      find_with_kernel<has_policy(decltype(policy)::value, search_policy::icase), has_policy(decltype(policy)::value, search_policy::reverse)>(kernel, hstr, hsearch, max_finds, fn);
+    });
+  }
+
+  // appends the offsets of the matches to results, see find_all()
+  template<bool case_insensitive, bool backward, size_t fixed_len = 0, class TContainer, class TC>
+  void find_all_into(TContainer &results, const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, size_t max_finds) {
+    const auto kernel = select_kernel(hstr.size(), hsearch, case_insensitive);
+    find_with_kernel<case_insensitive, backward, fixed_len>(kernel, hstr, hsearch, max_finds, [&results](size_t offset){
+      results.emplace_back(offset);
+    });
+  }
+
+  template<class TContainer, class TC>
+  void find_all_into(TContainer &results, const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsearch, bool backward, size_t max_finds, bool case_insensitive) {
+    with_policy(case_insensitive, backward, [&](auto policy){
+      find_all_into<has_policy(decltype(policy)::value, search_policy::icase), has_policy(decltype(policy)::value, search_policy::reverse)>(results, hstr, hsearch, max_finds);
+    });
+  }
+
+  // appends the tokens to tokens, see split()
+  // TPlaces is the container used for the splitters offsets
+  template<class TPlaces, bool case_insensitive, bool backward, size_t fixed_len = 0, class TTokens, class TC>
+  void split_into(TTokens &tokens, const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsplitter, bool keep_empty, size_t max_tokens) {
+    if (max_tokens == 0 || hstr.empty()) {
+      return;
+    }
+
+    if (max_tokens == 1 || hsplitter.empty() || hstr.size() < hsplitter.size()) {
+      tokens.emplace_back( std::basic_string<TC>(hstr.data(), hstr.size()) );
+      return;
+    }
+
+    TPlaces all_places{};
+    find_all_into<case_insensitive, backward, fixed_len>(all_places, hstr, hsplitter, max_tokens - 1 /*splitter count*/);
+    tokens.reserve(tokens.size() + all_places.size() + 1 /*tokens count*/);
+    split_places(hstr, all_places, hsplitter.size(), keep_empty, backward, [&tokens](const str_weak_ref_basic<TC> &token){
+      tokens.emplace_back( std::basic_string<TC>(token.data(), token.size()) );
+    });
+  }
+
+  template<class TPlaces, class TTokens, class TC>
+  void split_into(TTokens &tokens, const str_weak_ref_basic<TC> &hstr, const str_weak_ref_basic<TC> &hsplitter, bool keep_empty, bool backward, size_t max_tokens, bool case_insensitive) {
+    with_policy(case_insensitive, backward, [&](auto policy){
+      split_into<TPlaces, has_policy(decltype(policy)::value, search_policy::icase), has_policy(decltype(policy)::value, search_policy::reverse)>(tokens, hstr, hsplitter, keep_empty, max_tokens);
+    });
+  }
+} // helpers
+
+  // find_all<sutils::policy::icase | sutils::policy::reverse>(str, search), the flags are template arguments
+  template<search_policy policy, class TStr1, class TStr2, class = helpers::str_weak_ref_t<TStr2>>
+  std::vector<size_t> find_all(const TStr1 &str, const TStr2 &search, size_t max_finds = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hsearch = helpers::str_weak_ref(search);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hsearch)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    std::vector<size_t> results{};
+    helpers::find_all_into<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse)>(results, hstr, hsearch, max_finds);
+    return results;
+  }
+
+  template<class TStr1, class TStr2, class = helpers::str_weak_ref_t<TStr2>>
+  std::vector<size_t> find_all(const TStr1 &str, const TStr2 &search, bool backward = false, size_t max_finds = static_cast<size_t>(-1), bool case_insensitive = false) {
+    return helpers::with_policy(case_insensitive, backward, [&](auto policy){
+      return find_all<decltype(policy)::value>(str, search, max_finds);
+    });
+  }
+
+  // same as find_all(), but the offsets are stored inline up to N of them,
+  // with max_finds <= N the result never allocates
+  template<size_t N, class TStr1, class TStr2>
+  auto find_all_small(const TStr1 &str, const TStr2 &search, bool backward = false, size_t max_finds = static_cast<size_t>(-1), bool case_insensitive = false) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hsearch = helpers::str_weak_ref(search);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hsearch)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    small_vector<size_t, N> results{};
+    helpers::find_all_into(results, hstr, hsearch, backward, max_finds, case_insensitive);
+    return results;
+  }
+
+  // the kernel find_all() and the functions built on it use for these arguments
+  template<class TStr1, class TStr2>
+  search_kernel select_kernel(const TStr1 &str, const TStr2 &search, bool case_insensitive = false) noexcept {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hsearch = helpers::str_weak_ref(search);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hsearch)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    return helpers::select_kernel(hstr.size(), hsearch, case_insensitive);
+  }
+
+  // measures the crossover points of the kernels on the host, installs them with set_kernel_thresholds()
+  // and returns them so they can be saved and restored on the next run without measuring again,
+  // common_byte isn't measured and keeps its current value,
+  // takes a few milliseconds, meant to be called once at startup
+  inline kernel_thresholds calibrate_kernels() {
+    // pseudo random text, letters weighted like English
+    std::string text(1 << 16, ' ');
+    const char letters[] = "eeeeettttaaaoooiiinnnssshhrrdlcumwfgypbvk    ";
+    std::uint32_t seed = 0x2545F491u;
+    for (auto &cc : text) {
+      seed = seed * 1664525u + 1013904223u;
+      cc = letters[(seed >> 24) % (sizeof(letters) - 1)];
+    }
+
+    // best of a few runs in nanoseconds
+    const auto measure = [](auto &&run){
+      auto best = std::chrono::nanoseconds::max();
+      for (int round = 0; round < 5; ++round) {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        best = std::min(best, elapsed);
+      }
+      return best;
+    };
+
+    // every run stores its match count here, so the runs can't be optimized away
+    volatile size_t sink = 0;
+    const auto run_kernel = [&sink](search_kernel kernel, const std::string &str, size_t str_len, const std::string &needle, bool case_insensitive){
+      const auto hstr = helpers::str_weak_ref(str).substr(0, str_len);
+      size_t found = 0;
+      helpers::find_with_kernel(kernel, hstr, helpers::str_weak_ref(needle), false, static_cast<size_t>(-1), case_insensitive, [&found](size_t){
+        ++found;
+      });
+      sink = found;
+    };
+
+    // a needle from the middle of the text with its last char changed, so it's a rare full match
+    const auto needle_of = [&text](size_t len){
+      auto needle = text.substr(text.size() / 2, len);
+      needle.back() = 'q';
+      return needle;
+    };
+
+    auto values = get_kernel_thresholds();
+
+    // longest needle where comparing 2 chars at 16 offsets still beats the skip table
+#ifdef SUTILS_HAS_SSE2
+    values.pair_filter_max_len = 1;
+    for (size_t len = 2; len <= 64; len *= 2) {
+      const auto needle = needle_of(len);
+      const auto pair = measure([&]{ run_kernel(search_kernel::pair_filter, text, text.size(), needle, false); });
+      const auto skip = measure([&]{ run_kernel(search_kernel::skip_table, text, text.size(), needle, false); });
+      if (skip < pair) {
+        break;
+      }
+      values.pair_filter_max_len = len;
+    }
+#endif
+
+    // shortest needle where the skip table beats the naive search
+    values.skip_table_min_len = 64;
+    for (size_t len = 2; len <= 64; len *= 2) {
+      const auto needle = needle_of(len);
+      const auto naive = measure([&]{ run_kernel(search_kernel::naive, text, 4096, needle, true); });
+      const auto skip = measure([&]{ run_kernel(search_kernel::skip_table, text, 4096, needle, true); });
+      if (skip < naive) {
+        values.skip_table_min_len = len;
+        break;
+      }
+    }
+
+    // shortest string where building the table pays off
+    values.skip_table_min_str = 4096;
+    const auto needle = needle_of(std::max<size_t>(values.skip_table_min_len, 8));
+    for (size_t str_len = 16; str_len <= 4096; str_len *= 2) {
+      const auto naive = measure([&]{ for (int rep = 0; rep < 16; ++rep) run_kernel(search_kernel::naive, text, str_len, needle, true); });
+      const auto skip = measure([&]{ for (int rep = 0; rep < 16; ++rep) run_kernel(search_kernel::skip_table, text, str_len, needle, true); });
+      if (skip < naive) {
+        values.skip_table_min_str = str_len;
+        break;
+      }
+    }
+
+    set_kernel_thresholds(values);
+    return values;
+  }
+
+  template<search_policy policy, class TStr1, class TStr2, class TStr3, class = helpers::str_weak_ref_t<TStr2>>
+  auto replace_all(const TStr1 &str, const TStr2 &search, const TStr3 &replace, size_t max_replaces = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hsearch = helpers::str_weak_ref(search);
+    const auto hreplace = helpers::str_weak_ref(replace);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hsearch)::value_type;
+    using TC3 = typename decltype(hreplace)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value && std::is_same<TC1, TC3>::value, "mismatching char type");
+
+    if (max_replaces == 0) {
+      return std::basic_string<TC1>(hstr.data(), hstr.size());
+    }
+
+    std::vector<size_t> all_places{};
+    helpers::find_all_into<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse)>(all_places, hstr, hsearch, max_replaces);
+    return helpers::replace_places(hstr, all_places, hsearch.size(), hreplace, helpers::has_policy(policy, search_policy::reverse));
+  }
+
+  template<class TStr1, class TStr2, class TStr3, class = helpers::str_weak_ref_t<TStr2>>
+  auto replace_all(const TStr1 &str, const TStr2 &search, const TStr3 &replace, bool backward = false, size_t max_replaces = static_cast<size_t>(-1), bool case_insensitive = false) {
+    return helpers::with_policy(case_insensitive, backward, [&](auto policy){
+      return replace_all<decltype(policy)::value>(str, search, replace, max_replaces);
+    });
   }
 
   template<class TStr1, class TStr2>
@@ -500,8 +1645,8 @@ namespace sutils {
     return results.empty() ? -1 : static_cast<long long>(results[0]);
   }
 
-  template<class TStr1, class TStr2>
-  auto split(const TStr1 &str, const TStr2 &splitter, bool keep_empty = false, bool backward = false, size_t max_tokens = static_cast<size_t>(-1), bool case_insensitive = false) {
+  template<search_policy policy, class TStr1, class TStr2>
+  auto split(const TStr1 &str, const TStr2 &splitter, bool keep_empty = false, size_t max_tokens = static_cast<size_t>(-1)) {
     const auto hstr = helpers::str_weak_ref(str);
     const auto hsplitter = helpers::str_weak_ref(splitter);
 
@@ -510,49 +1655,2133 @@ namespace sutils {
 
     static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
 
-    if (max_tokens == 0 || hstr.empty()) {
-      return std::vector<std::basic_string<TC1>>{};
-    }
+    std::vector<std::basic_string<TC1>> tokens{};
+    helpers::split_into<std::vector<size_t>, helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse)>(tokens, hstr, hsplitter, keep_empty, max_tokens);
+    return tokens;
+  }
 
-    if (max_tokens == 1 || hsplitter.empty() || hstr.size() < hsplitter.size()) {
-      return std::vector<std::basic_string<TC1>>{ std::basic_string<TC1>(hstr.data(), hstr.size()) };
-    }
+  template<class TStr1, class TStr2>
+  auto split(const TStr1 &str, const TStr2 &splitter, bool keep_empty = false, bool backward = false, size_t max_tokens = static_cast<size_t>(-1), bool case_insensitive = false) {
+    return helpers::with_policy(case_insensitive, backward, [&](auto policy){
+      return split<decltype(policy)::value>(str, splitter, keep_empty, max_tokens);
+    });
+  }
 
-    const auto all_places = find_all(hstr, hsplitter, backward, max_tokens - 1 /*splitter count*/, case_insensitive);
-    if (all_places.empty()) {
-      return std::vector<std::basic_string<TC1>>{ std::basic_string<TC1>(hstr.data(), hstr.size()) };
-    }
+  // same as split(), but the tokens and the splitters offsets are stored inline up to N of them,
+  // with max_tokens <= N only the tokens which don't fit the small string buffer allocate
+  template<size_t N, class TStr1, class TStr2>
+  auto split_small(const TStr1 &str, const TStr2 &splitter, bool keep_empty = false, bool backward = false, size_t max_tokens = static_cast<size_t>(-1), bool case_insensitive = false) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hsplitter = helpers::str_weak_ref(splitter);
 
-    std::vector<std::basic_string<TC1>> tokens{};
-    tokens.reserve(all_places.size() + 1 /*tokens count*/);
-    size_t start = 0;
-    if (backward) {
-      for (size_t idx = all_places.size(); idx > 0; --idx) {
-        size_t offset = all_places[idx - 1];
-        const auto token_len = offset - start;
-        if (token_len > 0 || keep_empty) {
-          const auto token_str = hstr.substr(start, token_len);
-          tokens.emplace_back( std::basic_string<TC1>(token_str.data(), token_str.size()) );
-        }
-        start = offset + hsplitter.size();
-      }
-    } else {
-      for (size_t offset : all_places) {
-        const auto token_len = offset - start;
-        if (token_len > 0 || keep_empty) {
-          const auto token_str = hstr.substr(start, token_len);
-          tokens.emplace_back( std::basic_string<TC1>(token_str.data(), token_str.size()) );
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hsplitter)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    small_vector<std::basic_string<TC1>, N> tokens{};
+    helpers::split_into<small_vector<size_t, N>>(tokens, hstr, hsplitter, keep_empty, backward, max_tokens, case_insensitive);
+    return tokens;
+  }
+
+#if SUTILS_CPP_VERSION >= 202002L
+namespace helpers {
+  // a string literal as a template argument, its chars and length are constants at every call site
+  template<class TC, size_t N>
+  struct fixed_string {
+    using value_type = TC;
+    static constexpr size_t length = N - 1;
+
+    TC chars[N]{};
+
+    constexpr fixed_string(const TC (&str)[N]) noexcept {
+      std::copy_n(str, N, chars);
+    }
+
+    constexpr auto view() const noexcept {
+      return str_weak_ref_basic<TC>(chars, length);
+    }
+  };
+} // helpers
+
+  // sutils::find_all<"||">(str), or sutils::find_all<"ab", sutils::policy::icase>(str),
+  // the kernels get the needle length as a template argument
+  template<helpers::fixed_string search, search_policy policy = search_policy::none, class TStr>
+  std::vector<size_t> find_all(const TStr &str, size_t max_finds = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(search)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    std::vector<size_t> results{};
+    helpers::find_all_into<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse), search.length>(results, hstr, search.view(), max_finds);
+    return results;
+  }
+
+  template<helpers::fixed_string search, search_policy policy = search_policy::none, class TStr1, class TStr2>
+  auto replace_all(const TStr1 &str, const TStr2 &replace, size_t max_replaces = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hreplace = helpers::str_weak_ref(replace);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(search)::value_type;
+    using TC3 = typename decltype(hreplace)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value && std::is_same<TC1, TC3>::value, "mismatching char type");
+
+    if (max_replaces == 0) {
+      return std::basic_string<TC1>(hstr.data(), hstr.size());
+    }
+
+    std::vector<size_t> all_places{};
+    helpers::find_all_into<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse), search.length>(all_places, hstr, search.view(), max_replaces);
+    return helpers::replace_places(hstr, all_places, search.length, hreplace, helpers::has_policy(policy, search_policy::reverse));
+  }
+
+  template<helpers::fixed_string splitter, search_policy policy = search_policy::none, class TStr>
+  auto split(const TStr &str, bool keep_empty = false, size_t max_tokens = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(splitter)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    std::vector<std::basic_string<TC1>> tokens{};
+    helpers::split_into<std::vector<size_t>, helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse), splitter.length>(tokens, hstr, splitter.view(), keep_empty, max_tokens);
+    return tokens;
+  }
+
+  template<helpers::fixed_string s2, search_policy policy = search_policy::none, class TStr>
+  bool cmp(const TStr &s1) noexcept {
+    const auto hs1 = helpers::str_weak_ref(s1);
+
+    using TC1 = typename decltype(hs1)::value_type;
+    using TC2 = typename decltype(s2)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    return (hs1.size() == s2.length) &&
+      helpers::equal_chars<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse), s2.length>(hs1.data(), s2.chars);
+  }
+
+  template<helpers::fixed_string search, search_policy policy = search_policy::none, class TStr>
+  bool starts(const TStr &str) noexcept {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(search)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    // same rules for "" as starts() above
+    if (hstr.empty() != (search.length == 0)) {
+      return false;
+    }
+
+    return (hstr.size() >= search.length) &&
+      helpers::equal_chars<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse), search.length>(hstr.data(), search.chars);
+  }
+
+  template<helpers::fixed_string search, search_policy policy = search_policy::none, class TStr>
+  bool ends(const TStr &str) noexcept {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(search)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    // same rules for "" as ends() above
+    if (hstr.empty() != (search.length == 0)) {
+      return false;
+    }
+
+    return (hstr.size() >= search.length) &&
+      helpers::equal_chars<helpers::has_policy(policy, search_policy::icase), helpers::has_policy(policy, search_policy::reverse), search.length>(hstr.data() + (hstr.size() - search.length), search.chars);
+  }
+#endif
+}
+
+
+namespace sutils {
+  // the inverse of split(), sums the sizes first so the result is allocated once,
+  // the range is iterated twice, items can be anything helpers::str_weak_ref() accepts
+  template<class TRange, class TStr>
+  auto join(const TRange &range, const TStr &separator) {
+    const auto hseparator = helpers::str_weak_ref(separator);
+
+    using TC = typename decltype(hseparator)::value_type;
+
+    size_t total = 0;
+    size_t count = 0;
+    for (const auto &item : range) {
+      const auto hitem = helpers::str_weak_ref(item);
+
+      using TC2 = typename decltype(hitem)::value_type;
+
+      static_assert(std::is_same<TC, TC2>::value, "mismatching char type");
+
+      total += hitem.size();
+      ++count;
+    }
+
+    std::basic_string<TC> result{};
+    if (count == 0) {
+      return result;
+    }
+
+    result.reserve(total + (count - 1) * hseparator.size());
+    bool first_item = true;
+    for (const auto &item : range) {
+      const auto hitem = helpers::str_weak_ref(item);
+      if (!first_item) {
+        result.append(hseparator.data(), hseparator.size());
+      }
+      result.append(hitem.data(), hitem.size());
+      first_item = false;
+    }
+
+    return result;
+  }
+
+namespace helpers {
+
+  constexpr bool all_of(std::initializer_list<bool> values) noexcept {
+    for (const auto value : values) {
+      if (!value) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // a lazy concatenation of N parts, only views are held so it must not outlive them
+  template<class TC, size_t N>
+  class concat_expr {
+  private:
+    str_weak_ref_basic<TC> m_parts[N];
+
+  public:
+    using value_type = TC;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    template<class... TStrs>
+    constexpr explicit concat_expr(const TStrs &... strs) noexcept :
+      m_parts{ str_weak_ref(strs)... }
+    { }
+
+    // the length of the result, a constant expression when all the parts are literals
+    constexpr size_t size() const noexcept {
+      size_t total = 0;
+      for (size_t idx = 0; idx < N; ++idx) {
+        total += m_parts[idx].size();
+      }
+      return total;
+    }
+
+    // writes the result without a null terminator, returns the written count,
+    // or npos without writing anything when the buffer is too small
+    size_t write(TC *buffer, size_t capacity) const noexcept {
+      const auto total = size();
+      if (total > capacity) {
+        return npos;
+      }
+
+      for (size_t idx = 0; idx < N; ++idx) {
+        std::copy(m_parts[idx].data(), m_parts[idx].data() + m_parts[idx].size(), buffer);
+        buffer += m_parts[idx].size();
+      }
+      return total;
+    }
+
+    void append_to(std::basic_string<TC> &str) const {
+      str.reserve(str.size() + size());
+      for (size_t idx = 0; idx < N; ++idx) {
+        str.append(m_parts[idx].data(), m_parts[idx].size());
+      }
+    }
+
+    std::basic_string<TC> str() const {
+      std::basic_string<TC> result{};
+      append_to(result);
+      return result;
+    }
+
+    operator std::basic_string<TC>() const {
+      return str();
+    }
+  };
+
+}
+
+  // std::string joined = sutils::concat(a, "::", b);
+  template<class TStr, class... TStrs>
+  constexpr auto concat(const TStr &str, const TStrs &... strs) noexcept {
+    using TC = typename helpers::str_weak_ref_t<TStr>::value_type;
+
+    static_assert(helpers::all_of({ true, std::is_same<TC, typename helpers::str_weak_ref_t<TStrs>::value_type>::value... }), "mismatching char type");
+
+    return helpers::concat_expr<TC, 1 + sizeof...(TStrs)>(str, strs...);
+  }
+}
+
+
+namespace sutils {
+namespace helpers {
+
+  // a set of chars used as delimiters, classifies chars with a lookup table,
+  // and 16 bytes at a time when SIMD is available and the char type is 1 byte:
+  // up to 8 members with SSE2 compares, more ASCII members with the PSHUFB nibble lookup,
+  // which needs SSSE3 at compile time (__SSSE3__, e.g. -mssse3 or -march=native),
+  // without it (default x86-64 GCC/Clang flags, MSVC) larger sets use the scalar table
+  template<class TC>
+  class char_set {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+
+  private:
+    static constexpr bool is_byte = sizeof(value_type) == 1;
+    static constexpr size_t max_simd_cmp = 8;
+
+    bool m_table[256]{};
+    std::vector<value_type> m_wide{}; // members which don't fit the table
+    value_type m_chars[max_simd_cmp]{};
+    size_t m_count = 0;
+    bool m_ascii = true;
+
+#ifdef SUTILS_HAS_SSSE3
+    // https://en.wikipedia.org/wiki/SSSE3 (pshufb)
+    // bit (hi nibble) of m_lo_nibbles[lo nibble] is set for every member
+    std::uint8_t m_lo_nibbles[16]{};
+#endif
+
+  public:
+    explicit char_set(const str_weak_ref_basic<value_type> &chars) {
+      for (const auto cc : chars) {
+        if (contains(cc)) {
+          continue;
+        }
+
+        const auto code = char_code(cc);
+        if (code < 256) {
+          m_table[code] = true;
+        } else {
+          m_wide.emplace_back(cc);
+        }
+
+        if (m_count < max_simd_cmp) {
+          m_chars[m_count] = cc;
+        }
+        ++m_count;
+
+        if (code >= 128) {
+          m_ascii = false;
+        }
+#ifdef SUTILS_HAS_SSSE3
+        else {
+          m_lo_nibbles[code & 0x0F] = static_cast<std::uint8_t>(m_lo_nibbles[code & 0x0F] | (1u << (code >> 4)));
+        }
+#endif
+      }
+    }
+
+    size_t size() const noexcept {
+      return m_count;
+    }
+
+    bool empty() const noexcept {
+      return m_count == 0;
+    }
+
+    bool contains(value_type cc) const noexcept {
+      const auto code = char_code(cc);
+      if (code < 256) {
+        return m_table[code];
+      }
+      return std::find(m_wide.begin(), m_wide.end(), cc) != m_wide.end();
+    }
+
+    // index of the first member in [data, data + count), or count if not found
+    size_t find_in(const value_type *data, size_t count) const noexcept {
+      return find_in(data, count, std::integral_constant<bool, is_byte>{});
+    }
+
+  private:
+    size_t find_in(const value_type *data, size_t count, std::false_type) const noexcept {
+      for (size_t idx = 0; idx < count; ++idx) {
+        if (contains(data[idx])) {
+          return idx;
+        }
+      }
+      return count;
+    }
+
+    size_t find_in(const value_type *data, size_t count, std::true_type) const noexcept {
+      if (m_count == 1) {
+        const auto found = std::memchr(data, static_cast<int>(char_code(m_chars[0])), count);
+        return found ? static_cast<size_t>(static_cast<const value_type *>(found) - data) : count;
+      }
+
+      size_t idx = 0;
+#ifdef SUTILS_HAS_SSSE3
+      if (m_ascii && m_count > max_simd_cmp) {
+        const auto lo_nibbles = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m_lo_nibbles));
+        // only nibbles 0-7 can appear in the upper half of an ASCII char
+        const auto hi_bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+        const auto nibble_mask = _mm_set1_epi8(0x0F);
+        const auto zero = _mm_setzero_si128();
+        for (; idx + 16 <= count; idx += 16) {
+          const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + idx));
+          const auto lo = _mm_shuffle_epi8(lo_nibbles, _mm_and_si128(chunk, nibble_mask));
+          const auto hi = _mm_shuffle_epi8(hi_bits, _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble_mask));
+          const auto misses = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)));
+          const auto hits = ~misses & 0xFFFFu;
+          if (hits) {
+            return idx + lowest_bit(hits);
+          }
+        }
+      }
+#endif
+
+#ifdef SUTILS_HAS_SSE2
+      if (m_count <= max_simd_cmp) {
+        __m128i members[max_simd_cmp];
+        for (size_t mm = 0; mm < m_count; ++mm) {
+          members[mm] = _mm_set1_epi8(static_cast<char>(m_chars[mm]));
+        }
+        for (; idx + 16 <= count; idx += 16) {
+          const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + idx));
+          auto eq = _mm_cmpeq_epi8(chunk, members[0]);
+          for (size_t mm = 1; mm < m_count; ++mm) {
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(chunk, members[mm]));
+          }
+          const auto hits = static_cast<std::uint32_t>(_mm_movemask_epi8(eq));
+          if (hits) {
+            return idx + lowest_bit(hits);
+          }
+        }
+      }
+#endif
+
+      for (; idx < count; ++idx) {
+        if (m_table[char_code(data[idx])]) {
+          return idx;
+        }
+      }
+      return count;
+    }
+  };
+
+  // calls fn(token) for every token separated by any char of the set
+  // at most (max_tokens - 1) delimiters are consumed, the rest of the string is the last token
+  template<class TC, class TFn>
+  void split_any_each(const str_weak_ref_basic<TC> &hstr, const char_set<TC> &delimiters, bool keep_empty, size_t max_tokens, TFn &&fn) {
+    if (max_tokens == 0 || hstr.empty()) {
+      return;
+    }
+
+    const auto data = hstr.data();
+    const auto count = hstr.size();
+    size_t start = 0;
+    if (!delimiters.empty()) {
+      for (size_t splits = max_tokens - 1; splits > 0; --splits) {
+        const auto offset = start + delimiters.find_in(data + start, count - start);
+        if (offset >= count) {
+          break;
+        }
+
+        if (offset > start || keep_empty) {
+          fn(str_weak_ref_basic<TC>(data + start, offset - start));
+        }
+        start = offset + 1;
+      }
+    }
+    // add last/remaining part of the string (after last delimiter)
+    if (start < count || keep_empty) {
+      fn(str_weak_ref_basic<TC>(data + start, count - start));
+    }
+  }
+
+} // helpers
+} // sutils
+
+
+namespace sutils {
+  // calls fn(view) for every token of split_any() without copying them,
+  // the views point into str and are str_weak_ref_basic like the result of trim()
+  template<class TStr1, class TStr2, class TFn>
+  void for_each_split_any(const TStr1 &str, const TStr2 &delimiters, bool keep_empty, size_t max_tokens, TFn &&fn) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hdelimiters = helpers::str_weak_ref(delimiters);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hdelimiters)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    const helpers::char_set<TC1> delimiters_set(hdelimiters);
+    helpers::split_any_each(hstr, delimiters_set, keep_empty, max_tokens, fn);
+  }
+
+  template<class TStr1, class TStr2>
+  auto split_any(const TStr1 &str, const TStr2 &delimiters, bool keep_empty = false, size_t max_tokens = static_cast<size_t>(-1)) {
+    using TC = typename helpers::str_weak_ref_t<TStr1>::value_type;
+
+    std::vector<std::basic_string<TC>> tokens{};
+    for_each_split_any(str, delimiters, keep_empty, max_tokens, [&tokens](const helpers::str_weak_ref_basic<TC> &token){
+      tokens.emplace_back( std::basic_string<TC>(token.data(), token.size()) );
+    });
+    return tokens;
+  }
+
+  // calls fn(view) for every line of lines() without copying them, the views point into str
+  template<class TStr, class TFn>
+  void for_each_line(const TStr &str, bool keep_empty, size_t max_lines, TFn &&fn) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC = typename decltype(hstr)::value_type;
+
+    constexpr auto lf = static_cast<TC>('\n');
+    constexpr auto cr = static_cast<TC>('\r');
+
+    const helpers::char_set<TC> lf_set(helpers::str_weak_ref_basic<TC>(&lf, 1));
+    const auto str_end = hstr.data() + hstr.size();
+    helpers::split_any_each(hstr, lf_set, true, max_lines, [&](helpers::str_weak_ref_basic<TC> line){
+      // the empty token after a trailing line break
+      if (line.empty() && line.data() == str_end) {
+        return;
+      }
+
+      // only a CR right before an LF is part of the line break,
+      // the last allowed line holds the rest of the string as-is and ends at str_end
+      const bool lf_terminated = line.data() + line.size() < str_end;
+      if (lf_terminated && !line.empty() && *line.rbegin() == cr) {
+        line = line.substr(0, line.size() - 1);
+      }
+      if (!line.empty() || keep_empty) {
+        fn(line);
+      }
+    });
+  }
+
+  // split on "\n" and "\r\n", a trailing line break doesn't produce an extra empty line
+  template<class TStr>
+  auto lines(const TStr &str, bool keep_empty = true, size_t max_lines = static_cast<size_t>(-1)) {
+    using TC = typename helpers::str_weak_ref_t<TStr>::value_type;
+
+    std::vector<std::basic_string<TC>> result{};
+    for_each_line(str, keep_empty, max_lines, [&result](const helpers::str_weak_ref_basic<TC> &line){
+      result.emplace_back( std::basic_string<TC>(line.data(), line.size()) );
+    });
+    return result;
+  }
+}
+
+
+namespace sutils {
+namespace helpers {
+
+  // same set as std::isspace() in the "C" locale: ' ', '\t', '\n', '\v', '\f', '\r'
+  template<class TC>
+  constexpr bool is_ascii_space(TC cc) noexcept {
+    return (char_code(cc) == 0x20) || (char_code(cc) - 0x09 <= 0x04);
+  }
+
+  // index of the first ASCII whitespace in [data, data + count), or count if not found
+  template<class TC>
+  size_t find_ascii_space(const TC *data, size_t count) noexcept {
+    size_t idx = 0;
+#ifdef SUTILS_HAS_SSE2
+    if (sizeof(TC) == 1) {
+      const auto space = _mm_set1_epi8(0x20);
+      const auto tab_min = _mm_set1_epi8(0x09 - 1);
+      const auto cr_max = _mm_set1_epi8(0x0D + 1);
+      for (; idx + 16 <= count; idx += 16) {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + idx));
+        const auto controls = _mm_and_si128(_mm_cmpgt_epi8(chunk, tab_min), _mm_cmplt_epi8(chunk, cr_max));
+        const auto hits = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(controls, _mm_cmpeq_epi8(chunk, space))));
+        if (hits) {
+          return idx + lowest_bit(hits);
+        }
+      }
+    }
+#endif
+    for (; idx < count; ++idx) {
+      if (is_ascii_space(data[idx])) {
+        return idx;
+      }
+    }
+    return count;
+  }
+
+  // flips the case of every ASCII letter in [first, last], in place
+  // 'A'-'Z' to lower case, or 'a'-'z' to upper case
+  template<class TC, TC first, TC last>
+  void ascii_flip_case(TC *data, size_t count) noexcept {
+    size_t idx = 0;
+#ifdef SUTILS_HAS_SSE2
+    if (sizeof(TC) == 1) {
+      // signed compare is fine, chars >= 0x80 are negative and never in range
+      const auto range_min = _mm_set1_epi8(static_cast<char>(first - 1));
+      const auto range_max = _mm_set1_epi8(static_cast<char>(last + 1));
+      const auto case_bit = _mm_set1_epi8(0x20);
+      for (; idx + 16 <= count; idx += 16) {
+        const auto ptr = reinterpret_cast<__m128i *>(data + idx);
+        const auto chunk = _mm_loadu_si128(ptr);
+        const auto letters = _mm_and_si128(_mm_cmpgt_epi8(chunk, range_min), _mm_cmplt_epi8(chunk, range_max));
+        _mm_storeu_si128(ptr, _mm_xor_si128(chunk, _mm_and_si128(letters, case_bit)));
+      }
+    }
+#endif
+    for (; idx < count; ++idx) {
+      if (char_code(data[idx]) - char_code(first) <= static_cast<std::uint32_t>(last - first)) {
+        data[idx] = static_cast<TC>(data[idx] ^ 0x20);
+      }
+    }
+  }
+
+} // helpers
+} // sutils
+
+
+namespace sutils {
+  // whitespace functions only consider the ASCII whitespace chars and don't depend on the locale
+  template<class TStr>
+  auto ltrim(const TStr &str) noexcept {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    size_t start = 0;
+    while (start < hstr.size() && helpers::is_ascii_space(hstr.data()[start])) {
+      ++start;
+    }
+    return hstr.substr(static_cast<std::ptrdiff_t>(start));
+  }
+
+  template<class TStr>
+  auto rtrim(const TStr &str) noexcept {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    size_t len = hstr.size();
+    while (len > 0 && helpers::is_ascii_space(hstr.data()[len - 1])) {
+      --len;
+    }
+    return hstr.substr(0, len);
+  }
+
+  template<class TStr>
+  auto trim(const TStr &str) noexcept {
+    return rtrim(ltrim(str));
+  }
+
+  // replaces every run of whitespace with a single space
+  template<class TStr>
+  auto collapse_whitespace(const TStr &str) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC = typename decltype(hstr)::value_type;
+
+    std::basic_string<TC> result{};
+    result.reserve(hstr.size() + 1); // +1 for null
+    const auto data = hstr.data();
+    const auto count = hstr.size();
+    size_t start = 0;
+    while (start < count) {
+      const auto offset = start + helpers::find_ascii_space(data + start, count - start);
+      result.append(data + start, offset - start);
+      if (offset >= count) {
+        break;
+      }
+
+      result.push_back(static_cast<TC>(' '));
+      start = offset + 1;
+      while (start < count && helpers::is_ascii_space(data[start])) {
+        ++start;
+      }
+    }
+    return result;
+  }
+
+  // case functions only convert ASCII letters and don't depend on the locale
+  template<class TC>
+  void to_lower_inplace(std::basic_string<TC> &str) noexcept {
+    helpers::ascii_flip_case<TC, static_cast<TC>('A'), static_cast<TC>('Z')>(&str[0], str.size());
+  }
+
+  template<class TC>
+  void to_upper_inplace(std::basic_string<TC> &str) noexcept {
+    helpers::ascii_flip_case<TC, static_cast<TC>('a'), static_cast<TC>('z')>(&str[0], str.size());
+  }
+
+  template<class TStr>
+  auto to_lower(const TStr &str) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC = typename decltype(hstr)::value_type;
+
+    std::basic_string<TC> result(hstr.data(), hstr.size());
+    to_lower_inplace(result);
+    return result;
+  }
+
+  template<class TStr>
+  auto to_upper(const TStr &str) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC = typename decltype(hstr)::value_type;
+
+    std::basic_string<TC> result(hstr.data(), hstr.size());
+    to_upper_inplace(result);
+    return result;
+  }
+}
+
+
+namespace sutils {
+  // counters of the rolling hash search, accumulated over every call they're passed to
+  struct rolling_hash_stats {
+    size_t windows = 0; // haystack windows looked up in the hash tables
+    size_t probes = 0; // hash table slots inspected
+    size_t verifications = 0; // windows with a matching hash, compared with cmp()
+    size_t collisions = 0; // verifications which weren't a match
+  };
+
+  // Rabin-Karp search for many needles at once
+  // https://en.wikipedia.org/wiki/Rabin%E2%80%93Karp_algorithm
+  // needles are grouped by length, each group has its own open addressing table
+  // and the haystack is scanned once for all the groups
+  template<class TC>
+  class rolling_hash_searcher {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+  private:
+    // arithmetic is modulo 2^64, any odd base has a multiplicative inverse
+    static constexpr std::uint64_t base = 0x100000001B3ULL;
+
+    static constexpr std::uint64_t base_inverse() noexcept {
+      // Newton's iteration, every step doubles the correct low bits
+      std::uint64_t inv = base;
+      for (int step = 0; step < 6; ++step) {
+        inv *= 2 - base * inv;
+      }
+      return inv;
+    }
+
+    struct slot {
+      std::uint64_t hash;
+      size_t needle;
+    };
+
+    struct group {
+      size_t length;
+      std::uint64_t high_power; // base ^ (length - 1)
+      size_t count;
+      std::vector<slot> table; // size is a power of 2
+    };
+
+    std::vector<std::basic_string<value_type>> m_needles{};
+    std::vector<group> m_groups{}; // sorted by length, longest first
+    bool m_case_insensitive;
+
+    std::uint64_t fold(value_type cc) const noexcept {
+      return helpers::case_key(cc, m_case_insensitive);
+    }
+
+    std::uint64_t hash_of(const value_type *data, size_t count) const noexcept {
+      std::uint64_t hash = 0;
+      for (size_t idx = 0; idx < count; ++idx) {
+        hash = hash * base + fold(data[idx]);
+      }
+      return hash;
+    }
+
+    static size_t slot_of(std::uint64_t hash, const std::vector<slot> &table) noexcept {
+      // Fibonacci hashing, the low bits of the polynomial hash are weak
+      return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ULL) >> 32) & (table.size() - 1);
+    }
+
+    static void insert(std::vector<slot> &table, const slot &item) {
+      auto idx = slot_of(item.hash, table);
+      while (table[idx].needle != npos) {
+        idx = (idx + 1) & (table.size() - 1);
+      }
+      table[idx] = item;
+    }
+
+    // id of the needle at data with the given hash, or npos
+    size_t lookup(const group &grp, std::uint64_t hash, const value_type *data, rolling_hash_stats &stats) const {
+      ++stats.windows;
+      const auto &table = grp.table;
+      for (auto idx = slot_of(hash, table); ; idx = (idx + 1) & (table.size() - 1)) {
+        ++stats.probes;
+        const auto &item = table[idx];
+        if (item.needle == npos) {
+          return npos;
+        }
+
+        if (item.hash == hash) {
+          ++stats.verifications;
+          const auto window = helpers::str_weak_ref_basic<value_type>(data, grp.length);
+          if (cmp(window, m_needles[item.needle], m_case_insensitive)) {
+            return item.needle;
+          }
+          ++stats.collisions;
+        }
+      }
+    }
+
+  public:
+    explicit rolling_hash_searcher(bool case_insensitive = false) noexcept :
+      m_case_insensitive(case_insensitive)
+    { }
+
+    // only for iterable ranges, so a non bool flag still picks the constructor above
+    template<class TRange, class = decltype(std::begin(std::declval<const TRange &>()))>
+    explicit rolling_hash_searcher(const TRange &needles, bool case_insensitive = false) :
+      m_case_insensitive(case_insensitive)
+    {
+      for (const auto &needle : needles) {
+        add(needle);
+      }
+    }
+
+    // returns the id of the needle, adding the same needle again returns the same id,
+    // empty needles are ignored and return npos
+    template<class TStr>
+    size_t add(const TStr &needle) {
+      const auto hneedle = helpers::str_weak_ref(needle);
+
+      using TC2 = typename decltype(hneedle)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      if (hneedle.empty()) {
+        return npos;
+      }
+
+      auto grp = std::find_if(m_groups.begin(), m_groups.end(), [&hneedle](const group &item){
+        return item.length <= hneedle.size();
+      });
+      if (grp == m_groups.end() || grp->length != hneedle.size()) {
+        std::uint64_t high_power = 1;
+        for (size_t idx = 1; idx < hneedle.size(); ++idx) {
+          high_power *= base;
+        }
+        grp = m_groups.insert(grp, group{ hneedle.size(), high_power, 0, std::vector<slot>(8, slot{ 0, npos }) });
+      }
+
+      const auto hash = hash_of(hneedle.data(), hneedle.size());
+      rolling_hash_stats ignored{};
+      const auto existing = lookup(*grp, hash, hneedle.data(), ignored);
+      if (existing != npos) {
+        return existing;
+      }
+
+      // keep the load factor <= 0.5
+      if ((grp->count + 1) * 2 > grp->table.size()) {
+        std::vector<slot> table(grp->table.size() * 2, slot{ 0, npos });
+        for (const auto &item : grp->table) {
+          if (item.needle != npos) {
+            insert(table, item);
+          }
+        }
+        grp->table.swap(table);
+      }
+
+      const auto id = m_needles.size();
+      m_needles.emplace_back(hneedle.data(), hneedle.size());
+      insert(grp->table, slot{ hash, id });
+      ++grp->count;
+      return id;
+    }
+
+    size_t size() const noexcept {
+      return m_needles.size();
+    }
+
+    bool empty() const noexcept {
+      return m_needles.empty();
+    }
+
+    bool case_insensitive() const noexcept {
+      return m_case_insensitive;
+    }
+
+    const std::basic_string<value_type>& needle(size_t id) const noexcept {
+      return m_needles[id];
+    }
+
+    // calls fn(offset, needle id) for every non-overlapping match, in the same order as find_all(),
+    // when needles of different lengths match at the same place the longest one wins
+    template<class TFn>
+    void for_each_match(const helpers::str_weak_ref_basic<value_type> &hstr, bool backward, size_t max_finds, TFn &&fn, rolling_hash_stats *stats = nullptr) const {
+      rolling_hash_stats counters{};
+      if (backward) {
+        scan_backward(hstr, max_finds, fn, counters);
+      } else {
+        scan_forward(hstr, max_finds, fn, counters);
+      }
+
+      if (stats) {
+        stats->windows += counters.windows;
+        stats->probes += counters.probes;
+        stats->verifications += counters.verifications;
+        stats->collisions += counters.collisions;
+      }
+    }
+
+  private:
+    template<class TFn>
+    void scan_forward(const helpers::str_weak_ref_basic<value_type> &hstr, size_t max_finds, TFn &fn, rolling_hash_stats &stats) const {
+      if (m_groups.empty() || max_finds == 0) {
+        return;
+      }
+
+      const auto data = hstr.data();
+      const auto count = hstr.size();
+      const auto min_length = m_groups.back().length;
+      std::vector<std::uint64_t> hashes(m_groups.size());
+      size_t pos = 0;
+      bool rehash = true;
+      while (pos + min_length <= count) {
+        if (rehash) {
+          for (size_t gg = 0; gg < m_groups.size(); ++gg) {
+            if (pos + m_groups[gg].length <= count) {
+              hashes[gg] = hash_of(data + pos, m_groups[gg].length);
+            }
+          }
+          rehash = false;
+        }
+
+        size_t matched = 0;
+        for (size_t gg = 0; gg < m_groups.size(); ++gg) {
+          const auto &grp = m_groups[gg];
+          if (pos + grp.length <= count) {
+            const auto id = lookup(grp, hashes[gg], data + pos, stats);
+            if (id != npos) {
+              fn(pos, id);
+              matched = grp.length;
+              break;
+            }
+          }
+        }
+
+        if (matched) {
+          if (--max_finds == 0) {
+            return;
+          }
+          pos += matched;
+          rehash = true;
+          continue;
+        }
+
+        // slide every window one char forward
+        for (size_t gg = 0; gg < m_groups.size(); ++gg) {
+          const auto &grp = m_groups[gg];
+          if (pos + grp.length < count) {
+            hashes[gg] = (hashes[gg] - fold(data[pos]) * grp.high_power) * base + fold(data[pos + grp.length]);
+          }
+        }
+        ++pos;
+      }
+    }
+
+    template<class TFn>
+    void scan_backward(const helpers::str_weak_ref_basic<value_type> &hstr, size_t max_finds, TFn &fn, rolling_hash_stats &stats) const {
+      if (m_groups.empty() || max_finds == 0) {
+        return;
+      }
+
+      constexpr auto inverse = base_inverse();
+      const auto data = hstr.data();
+      const auto min_length = m_groups.back().length;
+      std::vector<std::uint64_t> hashes(m_groups.size());
+      size_t end = hstr.size();
+      bool rehash = true;
+      while (end >= min_length) {
+        if (rehash) {
+          for (size_t gg = 0; gg < m_groups.size(); ++gg) {
+            if (m_groups[gg].length <= end) {
+              hashes[gg] = hash_of(data + end - m_groups[gg].length, m_groups[gg].length);
+            }
+          }
+          rehash = false;
+        }
+
+        size_t matched = 0;
+        for (size_t gg = 0; gg < m_groups.size(); ++gg) {
+          const auto &grp = m_groups[gg];
+          if (grp.length <= end) {
+            const auto id = lookup(grp, hashes[gg], data + end - grp.length, stats);
+            if (id != npos) {
+              fn(end - grp.length, id);
+              matched = grp.length;
+              break;
+            }
+          }
+        }
+
+        if (matched) {
+          if (--max_finds == 0) {
+            return;
+          }
+          end -= matched;
+          rehash = true;
+          continue;
+        }
+
+        // slide every window one char backward
+        for (size_t gg = 0; gg < m_groups.size(); ++gg) {
+          const auto &grp = m_groups[gg];
+          if (grp.length < end) {
+            hashes[gg] = (hashes[gg] - fold(data[end - 1])) * inverse + fold(data[end - grp.length - 1]) * grp.high_power;
+          }
+        }
+        --end;
+      }
+    }
+  };
+
+  template<class TStr, class TC>
+  std::vector<size_t> find_all(const TStr &str, const rolling_hash_searcher<TC> &searcher, bool backward = false, size_t max_finds = static_cast<size_t>(-1), rolling_hash_stats *stats = nullptr) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename rolling_hash_searcher<TC>::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    std::vector<size_t> results{};
+    searcher.for_each_match(hstr, backward, max_finds, [&results](size_t offset, size_t){
+      results.emplace_back(offset);
+    }, stats);
+    return results;
+  }
+}
+
+
+namespace sutils {
+  // a needle compiled for one direction, with a Horspool bad char table
+  // https://en.wikipedia.org/wiki/Boyer%E2%80%93Moore%E2%80%93Horspool_algorithm
+  // immutable once constructed, safe to share between threads
+  template<class TC>
+  class needle_searcher {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+
+  private:
+    std::basic_string<value_type> m_needle;
+    bool m_case_insensitive;
+    bool m_backward;
+    size_t m_shift[256];
+
+  public:
+    template<class TStr>
+    explicit needle_searcher(const TStr &needle, bool case_insensitive = false, bool backward = false) :
+      m_needle(helpers::str_weak_ref(needle).data(), helpers::str_weak_ref(needle).size()),
+      m_case_insensitive(case_insensitive),
+      m_backward(backward)
+    {
+      helpers::horspool_table(m_shift, helpers::str_weak_ref(m_needle), case_insensitive, backward);
+    }
+
+    const std::basic_string<value_type>& needle() const noexcept {
+      return m_needle;
+    }
+
+    bool case_insensitive() const noexcept {
+      return m_case_insensitive;
+    }
+
+    bool backward() const noexcept {
+      return m_backward;
+    }
+
+    // calls fn(offset) for every match, in the same order as find_all()
+    template<class TFn>
+    void for_each_match(const helpers::str_weak_ref_basic<value_type> &hstr, size_t max_finds, TFn &&fn) const {
+      helpers::find_horspool(hstr, helpers::str_weak_ref(m_needle), m_shift, m_backward, max_finds, m_case_insensitive, fn);
+    }
+  };
+
+  template<class TStr, class TC>
+  std::vector<size_t> find_all(const TStr &str, const needle_searcher<TC> &searcher, size_t max_finds = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename needle_searcher<TC>::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value, "mismatching char type");
+
+    std::vector<size_t> results{};
+    searcher.for_each_match(hstr, max_finds, [&results](size_t offset){
+      results.emplace_back(offset);
+    });
+    return results;
+  }
+
+  template<class TStr1, class TC, class TStr2>
+  auto replace_all(const TStr1 &str, const needle_searcher<TC> &searcher, const TStr2 &replace, size_t max_replaces = static_cast<size_t>(-1)) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hreplace = helpers::str_weak_ref(replace);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename needle_searcher<TC>::value_type;
+    using TC3 = typename decltype(hreplace)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value && std::is_same<TC1, TC3>::value, "mismatching char type");
+
+    const auto all_places = find_all(hstr, searcher, max_replaces);
+    return helpers::replace_places(hstr, all_places, searcher.needle().size(), hreplace, searcher.backward());
+  }
+
+  // bounded cache of compiled needles, keyed by (needle, case_insensitive, backward)
+  // lookups only take a shared lock, misses compile the needle outside of any lock,
+  // a hit writes the lock word, the shared_ptr count and its thread's own hits counter,
+  // a full cache evicts with the CLOCK (second chance) policy
+  // https://en.wikipedia.org/wiki/Page_replacement_algorithm#Clock
+  template<class TC>
+  class searcher_cache {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+    using searcher_type = needle_searcher<value_type>;
+    using pointer = std::shared_ptr<const searcher_type>;
+
+    struct stats_type {
+      size_t hits;
+      size_t misses;
+      size_t evictions;
+    };
+
+  private:
+    struct entry {
+      std::uint64_t hash;
+      pointer searcher;
+      mutable std::atomic<bool> referenced;
+    };
+
+    // hits are counted in per thread stripes, each on its own cache line
+    static constexpr size_t hit_stripes = 16;
+    struct alignas(64) hit_counter {
+      std::atomic<size_t> value{ 0 };
+    };
+
+    const size_t m_capacity;
+    mutable std::shared_timed_mutex m_mutex{};
+    std::vector<std::unique_ptr<entry>> m_slots{}; // the CLOCK ring
+    std::unordered_multimap<std::uint64_t, size_t> m_index{}; // hash -> slot
+    size_t m_hand = 0;
+
+    hit_counter m_hits[hit_stripes]{};
+    std::atomic<size_t> m_misses{ 0 };
+    std::atomic<size_t> m_evictions{ 0 };
+
+    // FNV-1a
+    static std::uint64_t hash_of(const helpers::str_weak_ref_basic<value_type> &hneedle, bool case_insensitive, bool backward) noexcept {
+      std::uint64_t hash = 0xCBF29CE484222325ULL;
+      for (const auto cc : hneedle) {
+        hash = (hash ^ helpers::char_code(cc)) * 0x100000001B3ULL;
+      }
+      return (hash ^ (case_insensitive ? 1u : 0u) ^ (backward ? 2u : 0u)) * 0x100000001B3ULL;
+    }
+
+    static size_t stripe_of_this_thread() noexcept {
+      return std::hash<std::thread::id>{}(std::this_thread::get_id()) % hit_stripes;
+    }
+
+    // must hold the lock, shared or unique
+    pointer find_locked(std::uint64_t hash, const helpers::str_weak_ref_basic<value_type> &hneedle, bool case_insensitive, bool backward) const {
+      const auto range = m_index.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        const auto &item = *m_slots[it->second];
+        const auto &searcher = *item.searcher;
+        if (searcher.case_insensitive() == case_insensitive && searcher.backward() == backward && cmp(searcher.needle(), hneedle)) {
+          // only the first hit since the last sweep writes the entry
+          if (!item.referenced.load(std::memory_order_relaxed)) {
+            item.referenced.store(true, std::memory_order_relaxed);
+          }
+          return item.searcher;
+        }
+      }
+      return nullptr;
+    }
+
+  public:
+    explicit searcher_cache(size_t capacity = 256) :
+      m_capacity(capacity > 0 ? capacity : 1)
+    {
+      m_slots.reserve(m_capacity);
+      m_index.reserve(m_capacity);
+    }
+
+    searcher_cache(const searcher_cache &) = delete;
+    searcher_cache& operator=(const searcher_cache &) = delete;
+
+    template<class TStr>
+    pointer get(const TStr &needle, bool case_insensitive = false, bool backward = false) {
+      const auto hneedle = helpers::str_weak_ref(needle);
+
+      using TC2 = typename decltype(hneedle)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      const auto hash = hash_of(hneedle, case_insensitive, backward);
+      {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        auto found = find_locked(hash, hneedle, case_insensitive, backward);
+        if (found) {
+          m_hits[stripe_of_this_thread()].value.fetch_add(1, std::memory_order_relaxed);
+          return found;
+        }
+      }
+
+      m_misses.fetch_add(1, std::memory_order_relaxed);
+      pointer compiled = std::make_shared<const searcher_type>(hneedle, case_insensitive, backward);
+
+      std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+      // another thread might have added it in the meantime
+      auto found = find_locked(hash, hneedle, case_insensitive, backward);
+      if (found) {
+        return found;
+      }
+
+      size_t slot = m_slots.size();
+      if (slot < m_capacity) {
+        m_slots.emplace_back(new entry{ hash, compiled, { false } });
+      } else {
+        // give every referenced entry a second chance
+        while (m_slots[m_hand]->referenced.exchange(false, std::memory_order_relaxed)) {
+          m_hand = (m_hand + 1) % m_capacity;
+        }
+        slot = m_hand;
+        m_hand = (m_hand + 1) % m_capacity;
+
+        auto &victim = *m_slots[slot];
+        const auto range = m_index.equal_range(victim.hash);
+        for (auto it = range.first; it != range.second; ++it) {
+          if (it->second == slot) {
+            m_index.erase(it);
+            break;
+          }
+        }
+        victim.hash = hash;
+        victim.searcher = compiled;
+        victim.referenced.store(false, std::memory_order_relaxed);
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+      }
+      m_index.emplace(hash, slot);
+      return compiled;
+    }
+
+    size_t capacity() const noexcept {
+      return m_capacity;
+    }
+
+    size_t size() const {
+      std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+      return m_slots.size();
+    }
+
+    stats_type stats() const noexcept {
+      size_t hits = 0;
+      for (const auto &counter : m_hits) {
+        hits += counter.value.load(std::memory_order_relaxed);
+      }
+      return stats_type{
+        hits,
+        m_misses.load(std::memory_order_relaxed),
+        m_evictions.load(std::memory_order_relaxed),
+      };
+    }
+
+    // drops every entry, searchers still held by callers stay valid
+    void clear() {
+      std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+      m_slots.clear();
+      m_index.clear();
+      m_hand = 0;
+    }
+  };
+}
+
+
+namespace sutils {
+  // a text kept as pieces of the original string and of an append-only buffer of inserted text,
+  // edits only touch the piece list, the text is copied into one string only when requested
+  // https://en.wikipedia.org/wiki/Piece_table
+  template<class TC>
+  class piece_buffer {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+
+  private:
+    struct piece {
+      bool added; // from m_added or m_original
+      size_t start;
+      size_t len;
+    };
+
+    std::basic_string<value_type> m_original{};
+    std::basic_string<value_type> m_added{};
+    std::vector<piece> m_pieces{};
+    size_t m_size = 0;
+
+    const value_type* data_of(const piece &pc) const noexcept {
+      return (pc.added ? m_added.data() : m_original.data()) + pc.start;
+    }
+
+    helpers::str_weak_ref_basic<value_type> view_of(const piece &pc) const noexcept {
+      return helpers::str_weak_ref_basic<value_type>(data_of(pc), pc.len);
+    }
+
+    void reset_pieces() {
+      m_pieces.clear();
+      m_size = m_original.size();
+      if (m_size > 0) {
+        m_pieces.push_back(piece{ false, 0, m_size });
+      }
+    }
+
+    // merges with the last piece when they're contiguous in the same buffer
+    static void push_piece(std::vector<piece> &pieces, const piece &pc) {
+      if (pc.len == 0) {
+        return;
+      }
+      if (!pieces.empty()) {
+        auto &prev = pieces.back();
+        if (prev.added == pc.added && prev.start + prev.len == pc.start) {
+          prev.len += pc.len;
+          return;
+        }
+      }
+      pieces.push_back(pc);
+    }
+
+    // appends the pieces covering [begin, end) of the current text,
+    // idx and idx_start track the piece where the previous call stopped and must only move forward
+    void push_range(std::vector<piece> &pieces, size_t begin, size_t end, size_t &idx, size_t &idx_start) const {
+      while (begin < end) {
+        while (idx_start + m_pieces[idx].len <= begin) {
+          idx_start += m_pieces[idx].len;
+          ++idx;
+        }
+        const auto &pc = m_pieces[idx];
+        const auto offset = begin - idx_start;
+        const auto len = std::min(pc.len - offset, end - begin);
+        push_piece(pieces, piece{ pc.added, pc.start + offset, len });
+        begin += len;
+      }
+    }
+
+    // appends [begin, end) of the current text to out, idx and idx_start as in push_range()
+    void append_range(std::basic_string<value_type> &out, size_t begin, size_t end, size_t &idx, size_t &idx_start) const {
+      while (begin < end) {
+        while (idx_start + m_pieces[idx].len <= begin) {
+          idx_start += m_pieces[idx].len;
+          ++idx;
+        }
+        const auto &pc = m_pieces[idx];
+        const auto offset = begin - idx_start;
+        const auto len = std::min(pc.len - offset, end - begin);
+        out.append(data_of(pc) + offset, len);
+        begin += len;
+      }
+    }
+
+    // replaces [place, place + len) for every place (ascending, not overlapping) with the same text
+    void splice(const std::vector<size_t> &places, size_t len, const helpers::str_weak_ref_basic<value_type> &hreplace) {
+      const piece replacement{ true, m_added.size(), hreplace.size() };
+      m_added.append(hreplace.data(), hreplace.size());
+
+      std::vector<piece> pieces{};
+      pieces.reserve(m_pieces.size() + places.size() * 2 + 1);
+      size_t idx = 0;
+      size_t idx_start = 0;
+      size_t kept = 0;
+      for (const auto place : places) {
+        push_range(pieces, kept, place, idx, idx_start);
+        push_piece(pieces, replacement);
+        kept = place + len;
+      }
+      push_range(pieces, kept, m_size, idx, idx_start);
+
+      m_pieces.swap(pieces);
+      m_size = m_size - places.size() * len + places.size() * hreplace.size();
+    }
+
+    // whether the needle matches at pos, which is inside the piece idx starting at idx_start
+    bool matches_at(size_t pos, size_t idx, size_t idx_start, const helpers::str_weak_ref_basic<value_type> &hsearch, bool case_insensitive) const noexcept {
+      auto offset = pos - idx_start;
+      for (const auto cc : hsearch) {
+        while (offset >= m_pieces[idx].len) {
+          offset -= m_pieces[idx].len;
+          ++idx;
+        }
+        if (helpers::case_key(data_of(m_pieces[idx])[offset], case_insensitive) != helpers::case_key(cc, case_insensitive)) {
+          return false;
         }
-        start = offset + hsplitter.size();
+        ++offset;
       }
+      return true;
     }
-    // add last/remaining part of the string (after last splitter)
-    const auto token_len = hstr.size() - start;
-    if (token_len > 0 || keep_empty) {
-      const auto current_str = hstr.substr(start, token_len);
-      tokens.emplace_back( std::basic_string<TC1>(current_str.data(), current_str.size()) );
+
+    template<class TFn>
+    void find_forward(const helpers::str_weak_ref_basic<value_type> &hsearch, size_t max_finds, bool case_insensitive, TFn &fn) const {
+      const auto len = hsearch.size();
+      // the kernel and its table are picked once for the whole text, not per piece
+      const auto kernel = helpers::select_kernel(m_size, hsearch, case_insensitive);
+      size_t shift[256];
+      if (kernel == search_kernel::skip_table) {
+        helpers::horspool_table(shift, hsearch, case_insensitive, false);
+      }
+      size_t pos = 0; // no match may start before it
+      size_t idx_start = 0;
+      for (size_t idx = 0; (idx < m_pieces.size()) && (pos + len <= m_size) && (max_finds > 0); idx_start += m_pieces[idx].len, ++idx) {
+        const auto idx_end = idx_start + m_pieces[idx].len;
+        if (pos >= idx_end) {
+          continue;
+        }
+
+        // matches inside the piece always come before the ones crossing its end
+        const auto local = view_of(m_pieces[idx]).substr(static_cast<std::ptrdiff_t>(pos > idx_start ? pos - idx_start : 0));
+        helpers::find_with_table(kernel, shift, local, hsearch, false, max_finds, case_insensitive, [&](size_t offset){
+          fn(idx_end - local.size() + offset);
+          pos = idx_end - local.size() + offset + len;
+          --max_finds;
+        });
+
+        // windows starting in earlier pieces were already checked
+        const auto crossing_start = std::max(std::max(pos, idx_start), idx_end - std::min(idx_end, len - 1));
+        for (auto start = crossing_start; (start < idx_end) && (start + len <= m_size) && (max_finds > 0); ++start) {
+          if (matches_at(start, idx, idx_start, hsearch, case_insensitive)) {
+            fn(start);
+            pos = start + len;
+            --max_finds;
+            break;
+          }
+        }
+      }
+    }
+
+    template<class TFn>
+    void find_backward(const helpers::str_weak_ref_basic<value_type> &hsearch, size_t max_finds, bool case_insensitive, TFn &fn) const {
+      const auto len = hsearch.size();
+      // the kernel and its table are picked once for the whole text, not per piece
+      const auto kernel = helpers::select_kernel(m_size, hsearch, case_insensitive);
+      size_t shift[256];
+      if (kernel == search_kernel::skip_table) {
+        helpers::horspool_table(shift, hsearch, case_insensitive, true);
+      }
+      size_t end = m_size; // no match may end after it
+      size_t idx_end = m_size;
+      for (size_t idx = m_pieces.size(); (idx > 0) && (end >= len) && (max_finds > 0); idx_end -= m_pieces[idx - 1].len, --idx) {
+        const auto idx_start = idx_end - m_pieces[idx - 1].len;
+        if (end <= idx_start) {
+          continue;
+        }
+
+        // matches inside the piece always come before the ones crossing its start
+        const auto local = view_of(m_pieces[idx - 1]).substr(0, end - idx_start);
+        helpers::find_with_table(kernel, shift, local, hsearch, true, max_finds, case_insensitive, [&](size_t offset){
+          fn(idx_start + offset);
+          end = idx_start + offset;
+          --max_finds;
+        });
+
+        // windows ending inside the piece and starting before it
+        // windows ending in later pieces were already checked
+        const auto crossing_end = std::min(std::min(end, idx_end), idx_start + len - 1);
+        for (auto stop = crossing_end; (stop > idx_start) && (stop >= len) && (max_finds > 0); --stop) {
+          // find the piece where the window starts
+          auto first_idx = idx - 1;
+          auto first_start = idx_start;
+          while (first_start > stop - len) {
+            --first_idx;
+            first_start -= m_pieces[first_idx].len;
+          }
+          if (matches_at(stop - len, first_idx, first_start, hsearch, case_insensitive)) {
+            fn(stop - len);
+            end = stop - len;
+            --max_finds;
+            break;
+          }
+        }
+      }
+    }
+
+  public:
+    piece_buffer() = default;
+
+    explicit piece_buffer(std::basic_string<value_type> &&original) :
+      m_original(std::move(original))
+    {
+      reset_pieces();
+    }
+
+    template<class TStr>
+    explicit piece_buffer(const TStr &original) :
+      m_original(helpers::str_weak_ref(original).data(), helpers::str_weak_ref(original).size())
+    {
+      reset_pieces();
+    }
+
+    size_t size() const noexcept {
+      return m_size;
+    }
+
+    bool empty() const noexcept {
+      return m_size == 0;
+    }
+
+    size_t piece_count() const noexcept {
+      return m_pieces.size();
+    }
+
+    // calls fn(view) for every piece in order
+    template<class TFn>
+    void for_each_piece(TFn &&fn) const {
+      for (const auto &pc : m_pieces) {
+        fn(view_of(pc));
+      }
+    }
+
+    // copies [pos, pos + len) into a new string with a single allocation
+    std::basic_string<value_type> substr(size_t pos = 0, size_t len = static_cast<size_t>(-1)) const {
+      std::basic_string<value_type> result{};
+      if (pos >= m_size) {
+        return result;
+      }
+
+      len = std::min(len, m_size - pos);
+      result.reserve(len + 1); // +1 for null
+      size_t idx = 0;
+      size_t idx_start = 0;
+      append_range(result, pos, pos + len, idx, idx_start);
+      return result;
+    }
+
+    // copies the tokens between the splitters at places (ascending, not overlapping) into tokens,
+    // the pieces are walked once for all of them, see split()
+    template<class TTokens>
+    void split_places(TTokens &tokens, const std::vector<size_t> &places, size_t splitter_len, bool keep_empty) const {
+      size_t idx = 0;
+      size_t idx_start = 0;
+      size_t start = 0;
+      const auto add_token = [&](size_t end){
+        if (end > start || keep_empty) {
+          std::basic_string<value_type> token{};
+          token.reserve(end - start + 1); // +1 for null
+          append_range(token, start, end, idx, idx_start);
+          tokens.emplace_back(std::move(token));
+        }
+      };
+      for (const auto offset : places) {
+        add_token(offset);
+        start = offset + splitter_len;
+      }
+      // add last/remaining part of the text (after last splitter)
+      add_token(m_size);
+    }
+
+    std::basic_string<value_type> str() const {
+      return substr();
+    }
+
+    // replaces [pos, pos + len) with replace, pos past the end appends
+    template<class TStr>
+    void replace(size_t pos, size_t len, const TStr &replace) {
+      const auto hreplace = helpers::str_weak_ref(replace);
+
+      using TC2 = typename decltype(hreplace)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      pos = std::min(pos, m_size);
+      len = std::min(len, m_size - pos);
+      splice(std::vector<size_t>{ pos }, len, hreplace);
+    }
+
+    template<class TStr>
+    void insert(size_t pos, const TStr &str) {
+      replace(pos, 0, str);
+    }
+
+    void erase(size_t pos, size_t len = static_cast<size_t>(-1)) {
+      replace(pos, len, helpers::str_weak_ref_basic<value_type>(m_added.data(), 0));
+    }
+
+    // calls fn(offset) for every match in the same order as find_all(), including matches spanning pieces
+    template<class TStr, class TFn>
+    void for_each_match(const TStr &search, bool backward, size_t max_finds, bool case_insensitive, TFn &&fn) const {
+      const auto hsearch = helpers::str_weak_ref(search);
+
+      using TC2 = typename decltype(hsearch)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      if (hsearch.empty() || m_size < hsearch.size() || max_finds == 0) {
+        return;
+      }
+
+      if (backward) {
+        find_backward(hsearch, max_finds, case_insensitive, fn);
+      } else {
+        find_forward(hsearch, max_finds, case_insensitive, fn);
+      }
+    }
+
+    // same matches as replace_all() on the materialized text, returns the number of replacements
+    template<class TStr1, class TStr2>
+    size_t replace_all(const TStr1 &search, const TStr2 &replace, bool backward = false, size_t max_replaces = static_cast<size_t>(-1), bool case_insensitive = false) {
+      const auto hsearch = helpers::str_weak_ref(search);
+      const auto hreplace = helpers::str_weak_ref(replace);
+
+      using TC2 = typename decltype(hsearch)::value_type;
+      using TC3 = typename decltype(hreplace)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value && std::is_same<value_type, TC3>::value, "mismatching char type");
+
+      std::vector<size_t> places{};
+      for_each_match(hsearch, backward, max_replaces, case_insensitive, [&places](size_t offset){
+        places.emplace_back(offset);
+      });
+      if (places.empty()) {
+        return 0;
+      }
+
+      if (backward) {
+        std::reverse(places.begin(), places.end());
+      }
+      splice(places, hsearch.size(), hreplace);
+      return places.size();
+    }
+  };
+
+  template<class TC, class TStr>
+  std::vector<size_t> find_all(const piece_buffer<TC> &buffer, const TStr &search, bool backward = false, size_t max_finds = static_cast<size_t>(-1), bool case_insensitive = false) {
+    std::vector<size_t> results{};
+    buffer.for_each_match(search, backward, max_finds, case_insensitive, [&results](size_t offset){
+      results.emplace_back(offset);
+    });
+    return results;
+  }
+
+  template<class TC, class TStr>
+  auto split(const piece_buffer<TC> &buffer, const TStr &splitter, bool keep_empty = false, bool backward = false, size_t max_tokens = static_cast<size_t>(-1), bool case_insensitive = false) {
+    const auto hsplitter = helpers::str_weak_ref(splitter);
+
+    using TC1 = typename piece_buffer<TC>::value_type;
+
+    std::vector<std::basic_string<TC1>> tokens{};
+    if (max_tokens == 0 || buffer.empty()) {
+      return tokens;
+    }
+
+    std::vector<size_t> places{};
+    if (max_tokens > 1) {
+      buffer.for_each_match(hsplitter, backward, max_tokens - 1 /*splitter count*/, case_insensitive, [&places](size_t offset){
+        places.emplace_back(offset);
+      });
+    }
+    if (backward) {
+      std::reverse(places.begin(), places.end());
     }
 
+    tokens.reserve(places.size() + 1 /*tokens count*/);
+    buffer.split_places(tokens, places, hsplitter.size(), keep_empty);
     return tokens;
   }
 }
+
+
+namespace sutils {
+  // a string with the offsets of every occurrence (overlapping ones included) of a set of needles,
+  // edits only rescan the (needle length - 1) chars around the edited range and shift the later offsets
+  template<class TC>
+  class match_index {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+  private:
+    struct needle_entry {
+      std::basic_string<value_type> needle;
+      bool case_insensitive;
+      // KMP failure function, only needed when occurrences can overlap
+      // https://en.wikipedia.org/wiki/Knuth%E2%80%93Morris%E2%80%93Pratt_algorithm
+      std::vector<size_t> borders;
+      std::vector<size_t> matches;
+    };
+
+    std::basic_string<value_type> m_text{};
+    std::vector<needle_entry> m_needles{};
+
+    // appends every occurrence starting in [begin, last_start] to out
+    void scan(const needle_entry &entry, size_t begin, size_t last_start, std::vector<size_t> &out) const {
+      const auto len = entry.needle.size();
+      if (m_text.size() < len || begin > m_text.size() - len) {
+        return;
+      }
+
+      last_start = std::min(last_start, m_text.size() - len);
+      const auto region = helpers::str_weak_ref(m_text).substr(static_cast<std::ptrdiff_t>(begin), last_start - begin + len);
+      const auto hneedle = helpers::str_weak_ref(entry.needle);
+      if (entry.borders.empty()) {
+        // without a border 2 occurrences can't overlap, the non-overlapping search finds them all
+        const auto kernel = helpers::select_kernel(region.size(), hneedle, entry.case_insensitive);
+        helpers::find_with_kernel(kernel, region, hneedle, false, static_cast<size_t>(-1), entry.case_insensitive, [&out, begin](size_t offset){
+          out.emplace_back(begin + offset);
+        });
+        return;
+      }
+
+      size_t matched = 0;
+      for (size_t idx = 0; idx < region.size(); ++idx) {
+        const auto key = helpers::case_key(region.data()[idx], entry.case_insensitive);
+        while (matched > 0 && helpers::case_key(entry.needle[matched], entry.case_insensitive) != key) {
+          matched = entry.borders[matched - 1];
+        }
+        if (helpers::case_key(entry.needle[matched], entry.case_insensitive) == key) {
+          ++matched;
+        }
+        if (matched == len) {
+          out.emplace_back(begin + idx + 1 - len);
+          matched = entry.borders[matched - 1];
+        }
+      }
+    }
+
+  public:
+    match_index() = default;
+
+    explicit match_index(std::basic_string<value_type> &&text) :
+      m_text(std::move(text))
+    { }
+
+    template<class TStr>
+    explicit match_index(const TStr &text) :
+      m_text(helpers::str_weak_ref(text).data(), helpers::str_weak_ref(text).size())
+    { }
+
+    const std::basic_string<value_type>& str() const noexcept {
+      return m_text;
+    }
+
+    size_t size() const noexcept {
+      return m_text.size();
+    }
+
+    size_t needle_count() const noexcept {
+      return m_needles.size();
+    }
+
+    // scans the whole string once, returns the id of the needle, or npos for an empty needle
+    template<class TStr>
+    size_t add_needle(const TStr &needle, bool case_insensitive = false) {
+      const auto hneedle = helpers::str_weak_ref(needle);
+
+      using TC2 = typename decltype(hneedle)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      if (hneedle.empty()) {
+        return npos;
+      }
+
+      needle_entry entry{ std::basic_string<value_type>(hneedle.data(), hneedle.size()), case_insensitive, {}, {} };
+      std::vector<size_t> borders(hneedle.size(), 0);
+      for (size_t idx = 1, border = 0; idx < hneedle.size(); ++idx) {
+        const auto key = helpers::case_key(hneedle.data()[idx], case_insensitive);
+        while (border > 0 && helpers::case_key(hneedle.data()[border], case_insensitive) != key) {
+          border = borders[border - 1];
+        }
+        if (helpers::case_key(hneedle.data()[border], case_insensitive) == key) {
+          ++border;
+        }
+        borders[idx] = border;
+      }
+      if (borders.back() > 0) {
+        entry.borders.swap(borders);
+      }
+
+      scan(entry, 0, m_text.size(), entry.matches);
+      m_needles.emplace_back(std::move(entry));
+      return m_needles.size() - 1;
+    }
+
+    // ascending offsets of every occurrence of the needle
+    const std::vector<size_t>& matches(size_t id) const noexcept {
+      return m_needles[id].matches;
+    }
+
+    // replaces [pos, pos + len) with replace, pos past the end appends
+    template<class TStr>
+    void replace(size_t pos, size_t len, const TStr &replace) {
+      const auto hreplace = helpers::str_weak_ref(replace);
+
+      using TC2 = typename decltype(hreplace)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      pos = std::min(pos, m_text.size());
+      len = std::min(len, m_text.size() - pos);
+      if (len == 0 && hreplace.empty()) {
+        return;
+      }
+
+      m_text.replace(pos, len, hreplace.data(), hreplace.size());
+      const auto new_end = pos + hreplace.size();
+      std::vector<size_t> fresh{};
+      for (auto &entry : m_needles) {
+        auto &matches = entry.matches;
+        const auto needle_len = entry.needle.size();
+        // the first offset whose window can touch the edited range
+        const auto affected = pos >= needle_len - 1 ? pos - (needle_len - 1) : 0;
+
+        const auto first = std::lower_bound(matches.begin(), matches.end(), affected);
+        const auto last = std::lower_bound(first, matches.end(), pos + len);
+        for (auto it = last; it != matches.end(); ++it) {
+          *it = *it - len + hreplace.size();
+        }
+
+        fresh.clear();
+        if (new_end > affected) {
+          scan(entry, affected, new_end - 1, fresh);
+        }
+        const auto at = matches.erase(first, last);
+        matches.insert(at, fresh.begin(), fresh.end());
+      }
+    }
+
+    template<class TStr>
+    void insert(size_t pos, const TStr &str) {
+      replace(pos, 0, str);
+    }
+
+    void erase(size_t pos, size_t len = static_cast<size_t>(-1)) {
+      replace(pos, len, helpers::str_weak_ref_basic<value_type>(m_text.data(), 0));
+    }
+
+    template<class TStr>
+    void append(const TStr &str) {
+      replace(m_text.size(), 0, str);
+    }
+  };
+}
+
+
+namespace sutils {
+  struct intern_stats {
+    size_t strings = 0; // distinct strings in the pool
+    size_t lookups = 0; // calls to intern()
+    size_t requested_chars = 0; // chars of every interned string, repeats included
+    size_t stored_chars = 0; // chars copied into the arenas
+    size_t arena_bytes = 0; // bytes allocated for the arenas
+    size_t index_bytes = 0; // bytes of the entries and the hash tables
+    size_t probes = 0; // hash table slots inspected
+    size_t max_probe = 0; // longest probe sequence of a single lookup
+    size_t saved_bytes = 0; // bytes of the repeated chars which weren't copied again
+  };
+
+  // deduplicated string store, each distinct string is copied once into an arena
+  // and gets a stable uint32_t id, views returned by get() live as long as the pool.
+  // strings are spread over shards by their hash, each shard has its own lock,
+  // arena, and open addressing table, so threads interning different strings rarely wait,
+  // strings already in the pool are found under the shared lock, only new ones take the unique lock
+  template<class TC>
+  class intern_pool {
+  public:
+    using value_type = typename std::remove_cv<TC>::type;
+    using id_type = std::uint32_t;
+
+    static constexpr id_type npos = static_cast<id_type>(-1);
+
+  private:
+    static constexpr size_t block_chars = 4096;
+
+    struct entry {
+      const value_type *data;
+      size_t size;
+      std::uint64_t hash;
+    };
+
+    struct shard {
+      mutable std::shared_timed_mutex mutex{};
+      std::vector<std::unique_ptr<value_type[]>> blocks{};
+      size_t block_free = 0; // chars left in the last block
+      std::vector<entry> entries{};
+      std::vector<id_type> table{}; // local index + 1, 0 is an empty slot
+      intern_stats stats{}; // the insertion counters, only touched under the unique lock
+      // the lookup counters, updated under the shared lock
+      std::atomic<size_t> lookups{ 0 };
+      std::atomic<size_t> requested_chars{ 0 };
+      std::atomic<size_t> probes{ 0 };
+      std::atomic<size_t> max_probe{ 0 };
+    };
+
+    unsigned m_shard_bits = 0;
+    std::unique_ptr<shard[]> m_shards;
+
+    // FNV-1a, mixed with Fibonacci hashing so the top bits pick the shard
+    static std::uint64_t hash_of(const helpers::str_weak_ref_basic<value_type> &hstr) noexcept {
+      std::uint64_t hash = 0xCBF29CE484222325ULL;
+      for (const auto cc : hstr) {
+        hash = (hash ^ helpers::char_code(cc)) * 0x100000001B3ULL;
+      }
+      return hash * 0x9E3779B97F4A7C15ULL;
+    }
+
+    size_t shard_of(std::uint64_t hash) const noexcept {
+      return m_shard_bits == 0 ? 0 : static_cast<size_t>(hash >> (64 - m_shard_bits));
+    }
+
+    static size_t slot_of(std::uint64_t hash, size_t table_size) noexcept {
+      return static_cast<size_t>(hash ^ (hash >> 29)) & (table_size - 1);
+    }
+
+    // must hold the lock, shared or unique, returns the local index or npos
+    static id_type lookup(const shard &shd, std::uint64_t hash, const helpers::str_weak_ref_basic<value_type> &hstr, size_t *probes) noexcept {
+      if (shd.table.empty()) {
+        return npos;
+      }
+
+      const auto mask = shd.table.size() - 1;
+      size_t count = 0;
+      for (auto idx = slot_of(hash, shd.table.size()); ; idx = (idx + 1) & mask) {
+        ++count;
+        const auto local = shd.table[idx];
+        if (local == 0) {
+          break;
+        }
+
+        const auto &item = shd.entries[local - 1];
+        if (item.hash == hash && item.size == hstr.size() && std::equal(hstr.begin(), hstr.end(), item.data)) {
+          if (probes) {
+            *probes = count;
+          }
+          return local - 1;
+        }
+      }
+
+      if (probes) {
+        *probes = count;
+      }
+      return npos;
+    }
+
+    // must hold the unique lock
+    static void place(std::vector<id_type> &table, std::uint64_t hash, id_type local) noexcept {
+      const auto mask = table.size() - 1;
+      auto idx = slot_of(hash, table.size());
+      while (table[idx] != 0) {
+        idx = (idx + 1) & mask;
+      }
+      table[idx] = local + 1;
+    }
+
+    // must hold the unique lock
+    static void grow(shard &shd) {
+      std::vector<id_type> table(shd.table.empty() ? 64 : shd.table.size() * 2, 0);
+      for (size_t local = 0; local < shd.entries.size(); ++local) {
+        place(table, shd.entries[local].hash, static_cast<id_type>(local));
+      }
+      shd.stats.index_bytes += (table.size() - shd.table.size()) * sizeof(id_type);
+      shd.table.swap(table);
+    }
+
+    // must hold the unique lock
+    static const value_type* store(shard &shd, const helpers::str_weak_ref_basic<value_type> &hstr) {
+      static const value_type empty_str[1]{};
+      if (hstr.empty()) {
+        return empty_str;
+      }
+
+      if (hstr.size() > block_chars) {
+        // gets its own block, placed before the last one which keeps its free space
+        std::unique_ptr<value_type[]> own(new value_type[hstr.size()]);
+        std::copy(hstr.begin(), hstr.end(), own.get());
+        const auto data = own.get();
+        shd.blocks.insert(shd.blocks.empty() ? shd.blocks.end() : shd.blocks.end() - 1, std::move(own));
+        shd.stats.arena_bytes += hstr.size() * sizeof(value_type);
+        return data;
+      }
+
+      if (shd.block_free < hstr.size()) {
+        shd.blocks.emplace_back(new value_type[block_chars]);
+        shd.block_free = block_chars;
+        shd.stats.arena_bytes += block_chars * sizeof(value_type);
+      }
+
+      auto dst = shd.blocks.back().get() + (block_chars - shd.block_free);
+      std::copy(hstr.begin(), hstr.end(), dst);
+      shd.block_free -= hstr.size();
+      return dst;
+    }
+
+  public:
+    // the shards count is rounded up to a power of 2, at most 256
+    explicit intern_pool(size_t shards = 16) {
+      while (m_shard_bits < 8 && (size_t(1) << m_shard_bits) < shards) {
+        ++m_shard_bits;
+      }
+      m_shards.reset(new shard[size_t(1) << m_shard_bits]);
+    }
+
+    intern_pool(const intern_pool &) = delete;
+    intern_pool& operator=(const intern_pool &) = delete;
+
+    size_t shard_count() const noexcept {
+      return size_t(1) << m_shard_bits;
+    }
+
+    // id of the string, copies it into the pool the first time it's seen,
+    // returns npos when the shard of the string ran out of ids
+    template<class TStr>
+    id_type intern(const TStr &str) {
+      const auto hstr = helpers::str_weak_ref(str);
+
+      using TC2 = typename decltype(hstr)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      const auto hash = hash_of(hstr);
+      const auto shard_idx = shard_of(hash);
+      auto &shd = m_shards[shard_idx];
+
+      // repeats are the common case, they only take the shared lock
+      {
+        std::shared_lock<std::shared_timed_mutex> lock(shd.mutex);
+        size_t probes = 0;
+        const auto local = lookup(shd, hash, hstr, &probes);
+        shd.lookups.fetch_add(1, std::memory_order_relaxed);
+        shd.requested_chars.fetch_add(hstr.size(), std::memory_order_relaxed);
+        shd.probes.fetch_add(probes, std::memory_order_relaxed);
+        auto longest = shd.max_probe.load(std::memory_order_relaxed);
+        while (probes > longest && !shd.max_probe.compare_exchange_weak(longest, probes, std::memory_order_relaxed)) { }
+        if (local != npos) {
+          return static_cast<id_type>((local << m_shard_bits) | shard_idx);
+        }
+      }
+
+      std::lock_guard<std::shared_timed_mutex> lock(shd.mutex);
+      // another thread might have added it in the meantime
+      auto local = lookup(shd, hash, hstr, nullptr);
+      if (local == npos) {
+        // ids are (local index << shard bits) | shard, npos itself stays reserved
+        if (shd.entries.size() >= (npos >> m_shard_bits)) {
+          return npos;
+        }
+
+        // keeps the load factor under 3/4
+        if ((shd.entries.size() + 1) * 4 > shd.table.size() * 3) {
+          grow(shd);
+        }
+
+        local = static_cast<id_type>(shd.entries.size());
+        shd.entries.emplace_back(entry{ store(shd, hstr), hstr.size(), hash });
+        place(shd.table, hash, local);
+        ++shd.stats.strings;
+        shd.stats.stored_chars += hstr.size();
+        shd.stats.index_bytes += sizeof(entry);
+      }
+
+      return static_cast<id_type>((local << m_shard_bits) | shard_idx);
+    }
+
+    // id of the string if it's already in the pool, or npos
+    template<class TStr>
+    id_type find(const TStr &str) const {
+      const auto hstr = helpers::str_weak_ref(str);
+
+      using TC2 = typename decltype(hstr)::value_type;
+
+      static_assert(std::is_same<value_type, TC2>::value, "mismatching char type");
+
+      const auto hash = hash_of(hstr);
+      const auto shard_idx = shard_of(hash);
+      const auto &shd = m_shards[shard_idx];
+
+      std::shared_lock<std::shared_timed_mutex> lock(shd.mutex);
+      const auto local = lookup(shd, hash, hstr, nullptr);
+      return local == npos ? npos : static_cast<id_type>((local << m_shard_bits) | shard_idx);
+    }
+
+    // the interned string, or an empty view for an unknown id
+    helpers::str_weak_ref_basic<value_type> get(id_type id) const {
+      const auto &shd = m_shards[id & ((id_type(1) << m_shard_bits) - 1)];
+      const auto local = static_cast<size_t>(id >> m_shard_bits);
+
+      std::shared_lock<std::shared_timed_mutex> lock(shd.mutex);
+      if (id == npos || local >= shd.entries.size()) {
+        return helpers::str_weak_ref_basic<value_type>(nullptr, 0);
+      }
+
+      const auto &item = shd.entries[local];
+      return helpers::str_weak_ref_basic<value_type>(item.data, item.size);
+    }
+
+    size_t size() const {
+      size_t total = 0;
+      for (size_t idx = 0; idx < shard_count(); ++idx) {
+        std::shared_lock<std::shared_timed_mutex> lock(m_shards[idx].mutex);
+        total += m_shards[idx].entries.size();
+      }
+      return total;
+    }
+
+    intern_stats stats() const {
+      intern_stats total{};
+      for (size_t idx = 0; idx < shard_count(); ++idx) {
+        std::shared_lock<std::shared_timed_mutex> lock(m_shards[idx].mutex);
+        const auto &item = m_shards[idx].stats;
+        total.strings += item.strings;
+        total.lookups += m_shards[idx].lookups.load(std::memory_order_relaxed);
+        total.requested_chars += m_shards[idx].requested_chars.load(std::memory_order_relaxed);
+        total.stored_chars += item.stored_chars;
+        total.arena_bytes += item.arena_bytes;
+        total.index_bytes += item.index_bytes;
+        total.probes += m_shards[idx].probes.load(std::memory_order_relaxed);
+        total.max_probe = std::max(total.max_probe, m_shards[idx].max_probe.load(std::memory_order_relaxed));
+      }
+      total.saved_bytes = (total.requested_chars - total.stored_chars) * sizeof(value_type);
+      return total;
+    }
+  };
+
+  // same as split(), but each token is interned in the pool and only its id is returned
+  template<class TStr1, class TStr2, class TC>
+  std::vector<typename intern_pool<TC>::id_type> split_intern(const TStr1 &str, const TStr2 &splitter, intern_pool<TC> &pool, bool keep_empty = false, bool backward = false, size_t max_tokens = static_cast<size_t>(-1), bool case_insensitive = false) {
+    const auto hstr = helpers::str_weak_ref(str);
+    const auto hsplitter = helpers::str_weak_ref(splitter);
+
+    using TC1 = typename decltype(hstr)::value_type;
+    using TC2 = typename decltype(hsplitter)::value_type;
+
+    static_assert(std::is_same<TC1, TC2>::value && std::is_same<TC1, typename intern_pool<TC>::value_type>::value, "mismatching char type");
+
+    std::vector<typename intern_pool<TC>::id_type> ids{};
+    if (max_tokens == 0 || hstr.empty()) {
+      return ids;
+    }
+
+    if (max_tokens == 1 || hsplitter.empty() || hstr.size() < hsplitter.size()) {
+      ids.emplace_back(pool.intern(hstr));
+      return ids;
+    }
+
+    std::vector<size_t> all_places{};
+    helpers::find_all_into(all_places, hstr, hsplitter, backward, max_tokens - 1 /*splitter count*/, case_insensitive);
+    ids.reserve(all_places.size() + 1 /*tokens count*/);
+    helpers::split_places(hstr, all_places, hsplitter.size(), keep_empty, backward, [&ids, &pool](const helpers::str_weak_ref_basic<TC1> &token){
+      ids.emplace_back(pool.intern(token));
+    });
+    return ids;
+  }
+}
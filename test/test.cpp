@@ -3,6 +3,8 @@
 #include <iostream>
 #include <cassert>
 #include <chrono>
+#include <thread>
+#include <random>
 
 void test_str_weak_iterator() {
   constexpr auto s_4 = sutils::helpers::str_weak_ref("acd78");
@@ -323,6 +325,963 @@ void test_split() {
   
 }
 
+void test_split_any() {
+  {
+    auto result = sutils::split_any("abc,zx;dddd\tzzz", ",;\t");
+    assert((result.size() == 4) && "error");
+    assert(sutils::cmp(result[0], "abc") && "error");
+    assert(sutils::cmp(result[2], "dddd") && "error");
+    assert(sutils::cmp(result[3], "zzz") && "error");
+  }
+
+  {
+    auto result = sutils::split_any("abc,,zx;", ",;");
+    assert((result.size() == 2) && "error");
+    assert(sutils::cmp(result[1], "zx") && "error");
+  }
+
+  {
+    auto result = sutils::split_any("abc,,zx;", ",;", true);
+    assert((result.size() == 4) && "error");
+    assert(sutils::cmp(result[1], "") && "error");
+    assert(sutils::cmp(result[3], "") && "error");
+  }
+
+  {
+    auto result = sutils::split_any("abc,zx;dddd", ",;", false, 2);
+    assert((result.size() == 2) && "error");
+    assert(sutils::cmp(result[1], "zx;dddd") && "error");
+  }
+
+  {
+    auto result = sutils::split_any("abc,zx", "");
+    assert((result.size() == 1) && "error");
+    assert(sutils::cmp(result[0], "abc,zx") && "error");
+  }
+
+  {
+    auto result = sutils::split_any(L"abc zx\tdddd", L" \t");
+    assert((result.size() == 3) && "error");
+    assert(sutils::cmp(result[2], L"dddd") && "error");
+  }
+
+  {
+    // long enough for the vectorized scan, and more delimiters than the compare path handles
+    const std::string str = "the quick brown fox jumps over the lazy dog|0123456789abcdef0123456789abcdef#end";
+    auto result = sutils::split_any(str, "|#");
+    assert((result.size() == 3) && "error");
+    assert(sutils::cmp(result[1], "0123456789abcdef0123456789abcdef") && "error");
+
+    result = sutils::split_any(str, "|#!?@$%^&*");
+    assert((result.size() == 3) && "error");
+    assert(sutils::cmp(result[2], "end") && "error");
+
+    result = sutils::split_any(str, " ");
+    assert((result.size() == 9) && "error");
+    assert(sutils::cmp(result[8], "dog|0123456789abcdef0123456789abcdef#end") && "error");
+  }
+
+  // the views point into the string, nothing is copied
+  {
+    const std::string str = "abc,,zx;dddd";
+    std::vector<sutils::helpers::str_weak_ref_basic<char>> views{};
+    sutils::for_each_split_any(str, ",;", true, 3, [&views](sutils::helpers::str_weak_ref_basic<char> token){
+      views.emplace_back(token);
+    });
+    assert((views.size() == 3) && "error");
+    assert((views[0].data() == str.data() && sutils::cmp(views[0], "abc")) && "error");
+    assert((views[1].empty() && views[2].data() == str.data() + 5 && sutils::cmp(views[2], "zx;dddd")) && "error");
+  }
+}
+
+void test_lines() {
+  {
+    auto result = sutils::lines("abc\nzx\r\n\ndddd\n");
+    assert((result.size() == 4) && "error");
+    assert(sutils::cmp(result[0], "abc") && "error");
+    assert(sutils::cmp(result[1], "zx") && "error");
+    assert(sutils::cmp(result[2], "") && "error");
+    assert(sutils::cmp(result[3], "dddd") && "error");
+  }
+
+  {
+    auto result = sutils::lines("abc\nzx\r\n\r\ndddd", false);
+    assert((result.size() == 3) && "error");
+    assert(sutils::cmp(result[2], "dddd") && "error");
+  }
+
+  {
+    auto result = sutils::lines("abc\r\nzx\r\ndddd\r\n", true, 2);
+    assert((result.size() == 2) && "error");
+    assert(sutils::cmp(result[0], "abc") && "error");
+    assert(sutils::cmp(result[1], "zx\r\ndddd\r\n") && "error");
+  }
+
+  {
+    assert((sutils::lines("\n").size() == 1) && "error");
+    assert((sutils::lines("\n", false).size() == 0) && "error");
+    assert((sutils::lines("").size() == 0) && "error");
+    assert((sutils::lines("abc").size() == 1) && "error");
+  }
+
+  // a CR not followed by an LF isn't a line break
+  {
+    assert((sutils::lines(std::string("a\r")) == std::vector<std::string>{ "a\r" }) && "error");
+    assert((sutils::lines(std::string("a\r\n\r")) == std::vector<std::string>{ "a", "\r" }) && "error");
+    assert((sutils::lines(std::string("a\rb\r")) == std::vector<std::string>{ "a\rb\r" }) && "error");
+    assert((sutils::lines(std::string("a\r\nb\r"), true, 2) == std::vector<std::string>{ "a", "b\r" }) && "error");
+  }
+
+  // the views point into the string, the line breaks are left out
+  {
+    const std::wstring str = L"abc\r\n\nzx\n";
+    std::vector<sutils::helpers::str_weak_ref_basic<wchar_t>> views{};
+    sutils::for_each_line(str, false, static_cast<size_t>(-1), [&views](sutils::helpers::str_weak_ref_basic<wchar_t> line){
+      views.emplace_back(line);
+    });
+    assert((views.size() == 2) && "error");
+    assert((views[0].data() == str.data() && sutils::cmp(views[0], L"abc")) && "error");
+    assert((views[1].data() == str.data() + 6 && sutils::cmp(views[1], L"zx")) && "error");
+  }
+}
+
+void test_trim() {
+  assert(sutils::cmp(sutils::trim("  \t abc zx \r\n"), "abc zx") && "error");
+  assert(sutils::cmp(sutils::ltrim("  \t abc zx \r\n"), "abc zx \r\n") && "error");
+  assert(sutils::cmp(sutils::rtrim("  \t abc zx \r\n"), "  \t abc zx") && "error");
+  assert(sutils::cmp(sutils::trim("abc"), "abc") && "error");
+  assert(sutils::trim(" \v\f ").empty() && "error");
+  assert(sutils::trim("").empty() && "error");
+  assert(sutils::cmp(sutils::trim(std::wstring(L"\t abc ")), L"abc") && "error");
+}
+
+void test_case_conversion() {
+  assert((sutils::to_lower("Hello WORLD 123 [@]") == "hello world 123 [@]") && "error");
+  assert((sutils::to_upper("Hello world 123 {`}") == "HELLO WORLD 123 {`}") && "error");
+  assert((sutils::to_upper(L"abc\u00e9") == L"ABC\u00e9") && "error");
+  assert((sutils::to_lower("") == "") && "error");
+
+  {
+    // long enough for the vectorized path, with non-ASCII bytes
+    std::string str = "The Quick Brown Fox \xC3\x89 Jumps Over The Lazy Dog 0123456789 @[`{";
+    sutils::to_lower_inplace(str);
+    assert((str == "the quick brown fox \xC3\x89 jumps over the lazy dog 0123456789 @[`{") && "error");
+    sutils::to_upper_inplace(str);
+    assert((str == "THE QUICK BROWN FOX \xC3\x89 JUMPS OVER THE LAZY DOG 0123456789 @[`{") && "error");
+  }
+}
+
+void test_collapse_whitespace() {
+  assert((sutils::collapse_whitespace("a  b\t\t c\r\nd") == "a b c d") && "error");
+  assert((sutils::collapse_whitespace("  a b  ") == " a b ") && "error");
+  assert((sutils::collapse_whitespace("abc") == "abc") && "error");
+  assert((sutils::collapse_whitespace("") == "") && "error");
+  assert((sutils::collapse_whitespace(L"a \n b") == L"a b") && "error");
+  assert((sutils::collapse_whitespace("0123456789abcdef0123456789   abcdef\n\n0123456789abcdef") == "0123456789abcdef0123456789 abcdef 0123456789abcdef") && "error");
+}
+
+void test_find_all_max_finds() {
+  assert((sutils::find_all("aXa", "a", false, 2).size() == 2) && "error");
+  assert((sutils::find_all("aXa", "a", true, 2).size() == 2) && "error");
+  assert((sutils::first("xa", "a") == 1) && "error");
+  assert((sutils::last("ax", "a") == 0) && "error");
+  assert((sutils::first("xa", "b") == -1) && "error");
+}
+
+void test_rolling_hash_searcher() {
+  {
+    sutils::rolling_hash_searcher<char> searcher;
+    assert((searcher.add("||") == 0) && "error");
+    assert((searcher.add(std::string("||")) == 0) && "error");
+    assert((searcher.add("") == sutils::rolling_hash_searcher<char>::npos) && "error");
+    assert((searcher.size() == 1) && "error");
+
+    const std::string str = "aa||aaa||aaaa||a||aaaaaaa||zzz";
+    assert((sutils::find_all(str, searcher) == sutils::find_all(str, "||")) && "error");
+    assert((sutils::find_all(str, searcher, true) == sutils::find_all(str, "||", true)) && "error");
+    assert((sutils::find_all(str, searcher, false, 2) == sutils::find_all(str, "||", false, 2)) && "error");
+    assert((sutils::find_all(str, searcher, true, 3) == sutils::find_all(str, "||", true, 3)) && "error");
+  }
+
+  {
+    // a non bool flag must not be taken for a range of needles
+    const unsigned flags = 3;
+    sutils::rolling_hash_searcher<char> searcher(flags & 1);
+    assert((searcher.case_insensitive()) && "error");
+  }
+
+  {
+    // overlapping candidates must behave like find_all()
+    sutils::rolling_hash_searcher<char> searcher;
+    searcher.add("aa");
+    assert((sutils::find_all("aaaaa", searcher) == sutils::find_all("aaaaa", "aa")) && "error");
+    assert((sutils::find_all("aaaaa", searcher, true) == sutils::find_all("aaaaa", "aa", true)) && "error");
+  }
+
+  {
+    const std::vector<std::string> needles{ "id-0001", "id-0002", "id-0003", "xyz", "id-0002" };
+    sutils::rolling_hash_searcher<char> searcher(needles);
+    assert((searcher.size() == 4) && "error");
+
+    const std::string str = "id-0001 xyz id-0003 id-0004 id-0002xyz";
+    const std::vector<size_t> expected{ 0, 8, 12, 28, 35 };
+    assert((sutils::find_all(str, searcher) == expected) && "error");
+    const std::vector<size_t> expected_backward(expected.rbegin(), expected.rend());
+    assert((sutils::find_all(str, searcher, true) == expected_backward) && "error");
+
+    sutils::rolling_hash_stats stats{};
+    assert((sutils::find_all(str, searcher, false, 2, &stats).size() == 2) && "error");
+    assert((stats.verifications >= 2) && "error");
+    assert((stats.collisions == stats.verifications - 2) && "error");
+    assert((stats.probes >= stats.windows) && "error");
+  }
+
+  {
+    // the longest needle wins at the same offset
+    sutils::rolling_hash_searcher<char> searcher(std::vector<std::string>{ "ab", "abcd" });
+    assert((sutils::find_all("abcdab", searcher) == std::vector<size_t>{ 0, 4 }) && "error");
+    assert((sutils::find_all("abcdab", searcher, true) == std::vector<size_t>{ 4, 0 }) && "error");
+  }
+
+  {
+    sutils::rolling_hash_searcher<wchar_t> searcher(true);
+    searcher.add(L"NeEdLe");
+    assert((sutils::find_all(L"a needle, a NEEDLE", searcher) == std::vector<size_t>{ 2, 12 }) && "error");
+    assert((sutils::find_all(L"a needle, a NEEDLE", searcher).size() == sutils::find_all(L"a needle, a NEEDLE", L"needle", false, static_cast<size_t>(-1), true).size()) && "error");
+  }
+
+  {
+    // many needles, grows the tables
+    sutils::rolling_hash_searcher<char> searcher;
+    std::string str{};
+    for (int idx = 0; idx < 200; ++idx) {
+      const auto needle = "<" + std::to_string(idx * 7919) + ">";
+      searcher.add(needle);
+      if (idx % 3 == 0) {
+        str += needle + " ";
+      }
+    }
+    assert((sutils::find_all(str, searcher).size() == 67) && "error");
+    assert((sutils::find_all(str, searcher, true).size() == 67) && "error");
+  }
+}
+
+void test_needle_searcher() {
+  const std::string str = "aa||aaa||aaaa||a||aaaaaaa||zzz";
+  const std::string needles[] = { "||", "a", "aa", "aaa", "zzz", "a||a", "nope", "aa||aaa||aaaa||a||aaaaaaa||zzz" };
+  for (const auto &needle : needles) {
+    for (const bool backward : { false, true }) {
+      const sutils::needle_searcher<char> searcher(needle, false, backward);
+      assert((sutils::find_all(str, searcher) == sutils::find_all(str, needle, backward)) && "error");
+      assert((sutils::find_all(str, searcher, 2) == sutils::find_all(str, needle, backward, 2)) && "error");
+      assert((sutils::replace_all(str, searcher, "-") == sutils::replace_all(str, needle, "-", backward)) && "error");
+    }
+  }
+
+  {
+    const sutils::needle_searcher<char> searcher("A||Z", true);
+    assert((sutils::find_all("aa||zaa||Z", searcher) == std::vector<size_t>{ 1, 6 }) && "error");
+    assert((sutils::replace_all("aa||zaa||Z", searcher, "") == "aa") && "error");
+  }
+
+  {
+    const sutils::needle_searcher<wchar_t> searcher(L"\u0101b", false, true);
+    assert((sutils::find_all(L"\u0101b\u0201b\u0101b", searcher) == std::vector<size_t>{ 4, 0 }) && "error");
+  }
+
+  assert(sutils::find_all("abc", sutils::needle_searcher<char>("")).empty() && "error");
+}
+
+void test_searcher_cache() {
+  {
+    sutils::searcher_cache<char> cache(2);
+    const auto s1 = cache.get("||");
+    assert((cache.get(std::string("||")) == s1) && "error");
+    assert((cache.get("||", true) != s1) && "error");
+    assert((cache.stats().hits == 1 && cache.stats().misses == 2) && "error");
+    assert((sutils::find_all("a||b||c", *s1) == std::vector<size_t>{ 1, 4 }) && "error");
+
+    // "||" was referenced since the last sweep, the case insensitive one gets evicted
+    cache.get("||");
+    const auto s3 = cache.get("--");
+    assert((cache.stats().evictions == 1) && "error");
+    assert((cache.size() == 2) && "error");
+    assert((cache.get("||") == s1) && "error");
+    assert((cache.get("--") == s3) && "error");
+
+    // evicted searchers stay usable
+    cache.clear();
+    assert((cache.size() == 0) && "error");
+    assert((s1->needle() == "||") && "error");
+  }
+
+  {
+    sutils::searcher_cache<char> cache(8);
+    std::vector<std::thread> threads{};
+    for (int tt = 0; tt < 4; ++tt) {
+      threads.emplace_back([&cache, tt]{
+        for (int idx = 0; idx < 1000; ++idx) {
+          const auto needle = std::to_string((idx + tt) % 12);
+          const auto searcher = cache.get(needle);
+          assert((searcher->needle() == needle) && "error");
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    const auto stats = cache.stats();
+    assert((stats.hits + stats.misses == 4000) && "error");
+    assert((cache.size() == 8) && "error");
+  }
+}
+
+void test_small_vector() {
+  {
+    sutils::small_vector<std::string, 2> vec{};
+    assert((vec.empty() && vec.is_inline() && vec.capacity() == 2) && "error");
+    vec.emplace_back("abc");
+    vec.push_back(std::string(100, 'z'));
+    assert((vec.size() == 2 && vec.is_inline()) && "error");
+    vec.emplace_back("overflow");
+    assert((vec.size() == 3 && !vec.is_inline()) && "error");
+    assert((vec[0] == "abc" && vec[1].size() == 100 && vec.back() == "overflow") && "error");
+
+    auto copy = vec;
+    assert((copy == vec) && "error");
+    auto moved = std::move(copy);
+    assert((moved == vec && copy.empty()) && "error");
+
+    vec.pop_back();
+    assert((vec.size() == 2 && vec != moved) && "error");
+
+    sutils::small_vector<std::string, 2> small{ "x" };
+    moved = std::move(small);
+    assert((moved.size() == 1 && moved.is_inline() && moved[0] == "x") && "error");
+    moved.clear();
+    assert(moved.empty() && "error");
+  }
+
+  {
+    sutils::small_vector<size_t, 0> vec{};
+    vec.push_back(5);
+    assert((vec.size() == 1 && !vec.is_inline()) && "error");
+  }
+
+  {
+    // the pushed element may live in the buffer being replaced
+    sutils::small_vector<std::string, 1> vec{};
+    vec.emplace_back(100, 'x');
+    vec.push_back(vec[0]);
+    vec.push_back(vec[1]);
+    assert((vec.size() == 3 && vec[2] == std::string(100, 'x')) && "error");
+  }
+
+  {
+    // a copy throwing while growing leaves the vector as it was
+    struct throwing_copy {
+      static int &copies_left() {
+        static int count = 0;
+        return count;
+      }
+
+      std::string value;
+
+      explicit throwing_copy(std::string str) : value(std::move(str)) { }
+      throwing_copy(const throwing_copy &other) : value(other.value) {
+        if (copies_left()-- == 0) {
+          throw 1;
+        }
+      }
+      // not noexcept, so growing copies
+      throwing_copy(throwing_copy &&other) : value(std::move(other.value)) { }
+    };
+
+    throwing_copy::copies_left() = 100;
+    sutils::small_vector<throwing_copy, 2> vec{};
+    for (int idx = 0; idx < 4; ++idx) {
+      vec.emplace_back(std::string(50, static_cast<char>('a' + idx)));
+    }
+    throwing_copy::copies_left() = 2;
+    bool thrown = false;
+    try {
+      vec.reserve(16);
+    } catch (int) {
+      thrown = true;
+    }
+    assert((thrown && vec.size() == 4 && vec.capacity() < 16) && "error");
+    for (int idx = 0; idx < 4; ++idx) {
+      assert((vec[idx].value == std::string(50, static_cast<char>('a' + idx))) && "error");
+    }
+  }
+
+  {
+    // a move throwing while taking inline elements destroys the ones already moved
+    struct throwing_move {
+      static int &moves_left() {
+        static int count = 0;
+        return count;
+      }
+      static int &alive() {
+        static int count = 0;
+        return count;
+      }
+
+      std::string value;
+
+      explicit throwing_move(std::string str) : value(std::move(str)) { ++alive(); }
+      throwing_move(const throwing_move &other) : value(other.value) { ++alive(); }
+      throwing_move(throwing_move &&other) : value(std::move(other.value)) {
+        if (moves_left()-- == 0) {
+          throw 1;
+        }
+        ++alive();
+      }
+      ~throwing_move() { --alive(); }
+    };
+
+    {
+      sutils::small_vector<throwing_move, 4> vec{};
+      for (int idx = 0; idx < 3; ++idx) {
+        vec.emplace_back(std::string(50, static_cast<char>('a' + idx)));
+      }
+      sutils::small_vector<throwing_move, 4> target{};
+      target.emplace_back("x");
+
+      throwing_move::moves_left() = 2;
+      bool thrown = false;
+      try {
+        sutils::small_vector<throwing_move, 4> moved(std::move(vec));
+      } catch (int) {
+        thrown = true;
+      }
+      assert((thrown && throwing_move::alive() == 4) && "error");
+
+      throwing_move::moves_left() = 1;
+      thrown = false;
+      try {
+        target = std::move(vec);
+      } catch (int) {
+        thrown = true;
+      }
+      assert((thrown && target.empty() && throwing_move::alive() == 3) && "error");
+    }
+    assert((throwing_move::alive() == 0) && "error");
+  }
+}
+
+void test_find_all_small() {
+  const std::string str = "aa||aaa||aaaa||a||aaaaaaa||zzz";
+  for (const bool backward : { false, true }) {
+    const auto expected = sutils::find_all(str, "||", backward);
+    const auto result = sutils::find_all_small<8>(str, "||", backward);
+    assert(std::equal(result.begin(), result.end(), expected.begin(), expected.end()) && "error");
+    assert(result.is_inline() && "error");
+
+    const auto result_4 = sutils::find_all_small<4>(str, "||", backward);
+    assert(std::equal(result_4.begin(), result_4.end(), expected.begin(), expected.end()) && "error");
+    assert(!result_4.is_inline() && "error");
+
+    const auto bounded = sutils::find_all_small<4>(str, "||", backward, 4);
+    assert((bounded.size() == 4 && bounded.is_inline()) && "error");
+  }
+}
+
+void test_split_small() {
+  for (const bool keep_empty : { false, true }) {
+    for (const bool backward : { false, true }) {
+      const auto expected = sutils::split("abc||zx||||dddd||", "||", keep_empty, backward);
+      const auto result = sutils::split_small<4>("abc||zx||||dddd||", "||", keep_empty, backward);
+      assert(std::equal(result.begin(), result.end(), expected.begin(), expected.end()) && "error");
+    }
+  }
+
+  const auto bounded = sutils::split_small<2>("abc||zx||dddd", "||", false, false, 2);
+  assert((bounded.size() == 2 && bounded.is_inline()) && "error");
+  assert(sutils::cmp(bounded[1], "zx||dddd") && "error");
+}
+
+void test_search_kernels() {
+  const sutils::search_kernel kernels[] = {
+    sutils::search_kernel::single_char,
+    sutils::search_kernel::pair_filter,
+    sutils::search_kernel::skip_table,
+  };
+
+  std::mt19937 rng(26);
+  for (int round = 0; round < 3000; ++round) {
+    std::string str{};
+    std::string needle{};
+    const auto str_len = rng() % 80;
+    const auto needle_len = 1 + rng() % 6;
+    for (size_t idx = 0; idx < str_len; ++idx) {
+      str += "abAB|"[rng() % 5];
+    }
+    for (size_t idx = 0; idx < needle_len; ++idx) {
+      needle += "abAB|"[rng() % 5];
+    }
+    const bool backward = rng() % 2;
+    const bool case_insensitive = rng() % 2;
+    const auto max_finds = rng() % 4 ? static_cast<size_t>(-1) : static_cast<size_t>(rng() % 3);
+
+    const auto hstr = sutils::helpers::str_weak_ref(str);
+    const auto hneedle = sutils::helpers::str_weak_ref(needle);
+    std::vector<size_t> expected{};
+    sutils::helpers::find_with_kernel(sutils::search_kernel::naive, hstr, hneedle, backward, max_finds, case_insensitive, [&expected](size_t offset){
+      expected.emplace_back(offset);
+    });
+    for (const auto kernel : kernels) {
+      std::vector<size_t> result{};
+      sutils::helpers::find_with_kernel(kernel, hstr, hneedle, backward, max_finds, case_insensitive, [&result](size_t offset){
+        result.emplace_back(offset);
+      });
+      assert((result == expected) && "error");
+    }
+    assert((sutils::find_all(str, needle, backward, max_finds, case_insensitive) == expected) && "error");
+  }
+
+  {
+    const std::wstring str = L"\u0101b||\u0201b||\u0101b||zzzzzzzzzzzz";
+    const auto hstr = sutils::helpers::str_weak_ref(str);
+    for (const auto needle : { L"||", L"\u0101b", L"|" }) {
+      for (const bool backward : { false, true }) {
+        for (const auto kernel : kernels) {
+          std::vector<size_t> result{};
+          sutils::helpers::find_with_kernel(kernel, hstr, sutils::helpers::str_weak_ref(std::wstring(needle)), backward, static_cast<size_t>(-1), false, [&result](size_t offset){
+            result.emplace_back(offset);
+          });
+          assert((result == sutils::find_all(str, std::wstring(needle), backward)) && "error");
+        }
+      }
+    }
+  }
+}
+
+void test_select_kernel() {
+  const std::string long_str(1000, 'x');
+  assert((sutils::select_kernel(long_str, "") == sutils::search_kernel::none) && "error");
+  assert((sutils::select_kernel("ab", "abc") == sutils::search_kernel::none) && "error");
+  assert((sutils::select_kernel(long_str, "|") == sutils::search_kernel::single_char) && "error");
+  assert((sutils::select_kernel("abc", "ab", true) == sutils::search_kernel::naive) && "error");
+  assert((sutils::select_kernel(long_str, "needle", true) == sutils::search_kernel::skip_table) && "error");
+  assert((sutils::select_kernel(long_str, std::string(100, 'q')) == sutils::search_kernel::skip_table) && "error");
+#ifdef SUTILS_HAS_SSE2
+  assert((sutils::select_kernel(long_str, "||") == sutils::search_kernel::pair_filter) && "error");
+  assert((sutils::select_kernel(long_str, "#zq!") == sutils::search_kernel::pair_filter) && "error");
+  // only common chars, the filter would pass most offsets
+  assert((sutils::select_kernel(long_str, "the see") == sutils::search_kernel::skip_table) && "error");
+#endif
+  assert((std::string(sutils::kernel_name(sutils::search_kernel::skip_table)) == "skip_table") && "error");
+
+  const auto defaults = sutils::get_kernel_thresholds();
+  const auto calibrated = sutils::calibrate_kernels();
+  assert((calibrated.pair_filter_max_len == sutils::get_kernel_thresholds().pair_filter_max_len) && "error");
+  assert((calibrated.skip_table_min_len >= 2) && "error");
+  // not measured, keeps the installed value
+  assert((calibrated.common_byte == defaults.common_byte) && "error");
+  assert((sutils::find_all("aa||aaa||aaaa||a||aaaaaaa||zzz", "||").size() == 5) && "error");
+
+  sutils::kernel_thresholds no_skip_table{};
+  no_skip_table.skip_table_min_len = static_cast<size_t>(-1);
+  sutils::set_kernel_thresholds(no_skip_table);
+  assert((sutils::select_kernel(long_str, "needle", true) == sutils::search_kernel::naive) && "error");
+  sutils::set_kernel_thresholds(defaults);
+}
+
+void test_piece_buffer() {
+  {
+    sutils::piece_buffer<char> buffer(std::string("aa||aaa||aaaa||a||aaaaaaa||zzz"));
+    assert((buffer.replace_all("||", "-NICE!-") == 5) && "error");
+    assert((buffer.str() == "aa-NICE!-aaa-NICE!-aaaa-NICE!-a-NICE!-aaaaaaa-NICE!-zzz") && "error");
+    // the separators of the pieces are gone, "-a" spans pieces now
+    assert((sutils::find_all(buffer, "!-a") == sutils::find_all(buffer.str(), "!-a")) && "error");
+    assert((buffer.replace_all("!-a", "_") == 4) && "error");
+    assert((buffer.str() == "aa-NICE_aa-NICE_aaa-NICE_-NICE_aaaaaa-NICE!-zzz") && "error");
+    assert((buffer.size() == buffer.str().size()) && "error");
+  }
+
+  {
+    sutils::piece_buffer<char> buffer("abc||zx||dddd||");
+    buffer.insert(3, "|");
+    buffer.erase(0, 1);
+    buffer.replace(5, 2, "||");
+    assert((buffer.str() == "bc|||||||dddd||") && "error");
+    for (const bool keep_empty : { false, true }) {
+      for (const bool backward : { false, true }) {
+        assert((sutils::split(buffer, "||", keep_empty, backward) == sutils::split(buffer.str(), "||", keep_empty, backward)) && "error");
+        assert((sutils::split(buffer, "||", keep_empty, backward, 3) == sutils::split(buffer.str(), "||", keep_empty, backward, 3)) && "error");
+      }
+    }
+    assert((buffer.substr(2, 4) == "||||") && "error");
+    assert((buffer.substr(13) == "||") && "error");
+  }
+
+  {
+    // thousands of short pieces, split() must walk them once, not once per token
+    std::string text{};
+    for (int idx = 0; idx < 20000; ++idx) {
+      text += (idx % 3 == 0) ? "ab|" : "a|";
+    }
+    sutils::piece_buffer<char> buffer(text);
+    buffer.replace_all("a", "xy");
+    buffer.replace_all("b|", "|z");
+    const auto materialized = buffer.str();
+    assert((buffer.piece_count() > 10000 && materialized == sutils::replace_all(sutils::replace_all(text, "a", "xy"), "b|", "|z")) && "error");
+    for (const bool keep_empty : { false, true }) {
+      for (const bool backward : { false, true }) {
+        assert((sutils::split(buffer, "|", keep_empty, backward) == sutils::split(materialized, "|", keep_empty, backward)) && "error");
+        assert((sutils::split(buffer, "|z", keep_empty, backward, 100) == sutils::split(materialized, "|z", keep_empty, backward, 100)) && "error");
+      }
+    }
+    assert((buffer.substr(materialized.size() - 7, 5) == materialized.substr(materialized.size() - 7, 5)) && "error");
+  }
+
+  // random edits, every search must match the materialized text
+  std::mt19937 rng(32);
+  for (int round = 0; round < 300; ++round) {
+    std::string text{};
+    for (int idx = 0; idx < 30; ++idx) {
+      text += "abAB"[rng() % 4];
+    }
+    sutils::piece_buffer<char> buffer(text);
+    for (int edit = 0; edit < 6; ++edit) {
+      std::string part{};
+      for (size_t idx = rng() % 4; idx > 0; --idx) {
+        part += "abAB"[rng() % 4];
+      }
+      const auto pos = rng() % (text.size() + 1);
+      const auto len = rng() % 3;
+      buffer.replace(pos, len, part);
+      text.replace(pos, len, part);
+    }
+    assert((buffer.str() == text) && "error");
+
+    std::string needle{};
+    for (size_t idx = 1 + rng() % 4; idx > 0; --idx) {
+      needle += "abAB"[rng() % 4];
+    }
+    const bool backward = rng() % 2;
+    const bool case_insensitive = rng() % 2;
+    assert((sutils::find_all(buffer, needle, backward, static_cast<size_t>(-1), case_insensitive) == sutils::find_all(text, needle, backward, static_cast<size_t>(-1), case_insensitive)) && "error");
+    assert((sutils::find_all(buffer, needle, backward, 2, case_insensitive) == sutils::find_all(text, needle, backward, 2, case_insensitive)) && "error");
+
+    std::string replacement(rng() % 3, '_');
+    buffer.replace_all(needle, replacement, backward, static_cast<size_t>(-1), case_insensitive);
+    assert((buffer.str() == sutils::replace_all(text, needle, replacement, backward, static_cast<size_t>(-1), case_insensitive)) && "error");
+  }
+}
+
+void test_match_index() {
+  {
+    sutils::match_index<char> index(std::string("aa||aaa||aaaa"));
+    const auto bars = index.add_needle("||");
+    const auto aa = index.add_needle("aa");
+    assert((index.add_needle("") == sutils::match_index<char>::npos) && "error");
+    assert((index.matches(bars) == std::vector<size_t>{ 2, 7 }) && "error");
+    // overlapping occurrences are included
+    assert((index.matches(aa) == std::vector<size_t>{ 0, 4, 5, 9, 10, 11 }) && "error");
+
+    index.insert(3, "a");
+    assert((index.str() == "aa|a|aaa||aaaa") && "error");
+    assert((index.matches(bars) == std::vector<size_t>{ 8 }) && "error");
+    assert((index.matches(aa) == std::vector<size_t>{ 0, 5, 6, 10, 11, 12 }) && "error");
+
+    index.erase(3, 1);
+    index.append("||");
+    assert((index.matches(bars) == std::vector<size_t>{ 2, 7, 13 }) && "error");
+    index.replace(0, 2, "A");
+    assert((index.str() == "A||aaa||aaaa||") && "error");
+    assert((index.matches(aa) == std::vector<size_t>{ 3, 4, 8, 9, 10 }) && "error");
+  }
+
+  {
+    sutils::match_index<wchar_t> index(L"Needle needle");
+    const auto id = index.add_needle(L"NEEDLE", true);
+    assert((index.matches(id) == std::vector<size_t>{ 0, 7 }) && "error");
+    index.erase(2, 1);
+    assert((index.matches(id) == std::vector<size_t>{ 6 }) && "error");
+  }
+
+  // random edits, every needle must match a full rescan
+  std::mt19937 rng(33);
+  const std::string needles[] = { "ab", "aba", "aaa", "b", "AbAb" };
+  for (int round = 0; round < 200; ++round) {
+    std::string text{};
+    for (int idx = 0; idx < 40; ++idx) {
+      text += "abAB"[rng() % 4];
+    }
+    sutils::match_index<char> index(text);
+    const bool case_insensitive = rng() % 2;
+    for (const auto &needle : needles) {
+      index.add_needle(needle, case_insensitive);
+    }
+    for (int edit = 0; edit < 10; ++edit) {
+      std::string part{};
+      for (size_t idx = rng() % 5; idx > 0; --idx) {
+        part += "abAB"[rng() % 4];
+      }
+      const auto pos = rng() % (index.size() + 1);
+      index.replace(pos, rng() % 4, part);
+    }
+
+    for (size_t id = 0; id < index.needle_count(); ++id) {
+      std::vector<size_t> expected{};
+      for (size_t pos = 0; pos + needles[id].size() <= index.size(); ++pos) {
+        if (sutils::starts(index.str().substr(pos), needles[id], case_insensitive)) {
+          expected.emplace_back(pos);
+        }
+      }
+      assert((index.matches(id) == expected) && "error");
+    }
+  }
+}
+
+void test_join() {
+  const std::vector<std::string> parts{ "a", "", "bc" };
+  assert((sutils::join(parts, ", ") == "a, , bc") && "error");
+  assert((sutils::join(std::vector<std::string>{}, ", ").empty()) && "error");
+  assert((sutils::join(std::vector<std::string>{ "x" }, ", ") == "x") && "error");
+
+  const auto tokens = sutils::split(std::string("a||b||c"), "||");
+  assert((sutils::join(tokens, "||") == "a||b||c") && "error");
+
+  const std::wstring text(L"key = value");
+  sutils::small_vector<sutils::helpers::str_weak_ref_basic<wchar_t>, 2> pair{};
+  pair.emplace_back(sutils::trim(sutils::helpers::str_weak_ref(text).substr(0, 4)));
+  pair.emplace_back(sutils::trim(sutils::helpers::str_weak_ref(text).substr(5)));
+  assert((sutils::join(pair, L"=") == L"key=value") && "error");
+}
+
+void test_concat() {
+  constexpr auto literals = sutils::concat("ab", "", "cde");
+  static_assert(literals.size() == 5, "error");
+  assert((literals.str() == "abcde") && "error");
+
+  const std::string name("name");
+  const std::string joined = sutils::concat(name, "::", name);
+  assert((joined == "name::name") && "error");
+
+  char buffer[16]{};
+  assert((sutils::concat(name, "!").write(buffer, 4) == static_cast<size_t>(-1)) && "error");
+  assert((buffer[0] == '\0') && "error");
+  assert((sutils::concat(name, "!").write(buffer, sizeof(buffer)) == 5) && "error");
+  assert((std::string(buffer) == "name!") && "error");
+
+  std::wstring out(L">");
+  sutils::concat(L"a", std::wstring(L"b")).append_to(out);
+  assert((out == L">ab") && "error");
+}
+
+void test_intern_pool() {
+  {
+    sutils::intern_pool<char> pool(3);
+    assert((pool.shard_count() == 4) && "error");
+    const auto get = pool.intern(std::string("GET"));
+    const auto post = pool.intern(std::string("POST"));
+    assert((get != post) && "error");
+    assert((pool.intern(std::string("GET")) == get) && "error");
+    assert((pool.find(std::string("POST")) == post) && "error");
+    assert((pool.find(std::string("PUT")) == sutils::intern_pool<char>::npos) && "error");
+    assert((sutils::cmp(pool.get(get), "GET")) && "error");
+    assert((sutils::cmp(pool.get(post), "POST")) && "error");
+    assert((pool.get(sutils::intern_pool<char>::npos).empty()) && "error");
+
+    const std::string big(5000, 'x');
+    const auto big_id = pool.intern(big);
+    const auto small_id = pool.intern(std::string("y"));
+    assert((sutils::cmp(pool.get(big_id), big)) && "error");
+    assert((sutils::cmp(pool.get(small_id), "y")) && "error");
+    assert((pool.size() == 4) && "error");
+
+    const auto stats = pool.stats();
+    assert((stats.strings == 4 && stats.lookups == 5) && "error");
+    assert((stats.saved_bytes == 3) && "error");
+    assert((stats.probes >= stats.max_probe && stats.max_probe >= 1) && "error");
+  }
+
+  {
+    sutils::intern_pool<char> pool{};
+    std::vector<std::string> unique{};
+    std::vector<sutils::intern_pool<char>::id_type> ids{};
+    for (int idx = 0; idx < 10000; ++idx) {
+      unique.emplace_back("token_" + std::to_string(idx));
+      ids.emplace_back(pool.intern(unique.back()));
+    }
+    for (size_t idx = 0; idx < unique.size(); ++idx) {
+      assert((sutils::cmp(pool.get(ids[idx]), unique[idx])) && "error");
+      assert((pool.intern(unique[idx]) == ids[idx]) && "error");
+    }
+    assert((pool.size() == unique.size()) && "error");
+  }
+
+  // the same strings from many threads must get the same ids
+  {
+    sutils::intern_pool<wchar_t> pool(8);
+    std::vector<std::vector<sutils::intern_pool<wchar_t>::id_type>> results(4);
+    std::vector<std::thread> threads{};
+    for (size_t tt = 0; tt < results.size(); ++tt) {
+      threads.emplace_back([&pool, &results, tt]{
+        for (int idx = 0; idx < 2000; ++idx) {
+          results[tt].emplace_back(pool.intern(L"host" + std::to_wstring(idx % 500)));
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    for (size_t tt = 1; tt < results.size(); ++tt) {
+      assert((results[tt] == results[0]) && "error");
+    }
+    assert((pool.size() == 500) && "error");
+    assert((sutils::cmp(pool.get(results[0][1]), L"host1")) && "error");
+  }
+}
+
+void test_split_intern() {
+  sutils::intern_pool<char> pool{};
+  const auto first = sutils::split_intern(std::string("10.0.0.1 GET 200"), " ", pool);
+  const auto second = sutils::split_intern(std::string("10.0.0.2 GET 200"), " ", pool);
+  assert((first.size() == 3 && second.size() == 3) && "error");
+  assert((first[0] != second[0] && first[1] == second[1] && first[2] == second[2]) && "error");
+  assert((sutils::cmp(pool.get(first[1]), "GET")) && "error");
+  assert((pool.size() == 4) && "error");
+
+  const std::string line("a||b||||c");
+  for (int keep_empty = 0; keep_empty < 2; ++keep_empty) {
+    for (int backward = 0; backward < 2; ++backward) {
+      for (size_t max_tokens = 0; max_tokens < 6; ++max_tokens) {
+        const auto tokens = sutils::split(line, "||", keep_empty, backward, max_tokens);
+        const auto ids = sutils::split_intern(line, "||", pool, keep_empty, backward, max_tokens);
+        assert((ids.size() == tokens.size()) && "error");
+        for (size_t idx = 0; idx < ids.size(); ++idx) {
+          assert((sutils::cmp(pool.get(ids[idx]), tokens[idx])) && "error");
+        }
+      }
+    }
+  }
+}
+
+void test_search_policy() {
+  const std::string str("ab||AB||ab");
+  assert((sutils::find_all<sutils::search_policy::none>(str, "ab") == std::vector<size_t>{ 0, 8 }) && "error");
+  assert((sutils::find_all<sutils::policy::icase>(str, "ab") == std::vector<size_t>{ 0, 4, 8 }) && "error");
+  assert((sutils::find_all<sutils::policy::icase | sutils::policy::reverse>(str, "ab", 2) == std::vector<size_t>{ 8, 4 }) && "error");
+  assert((sutils::replace_all<sutils::policy::icase>(str, "ab", "x") == "x||x||x") && "error");
+  assert((sutils::replace_all<sutils::policy::reverse>(str, "||", "-", 1) == "ab||AB-ab") && "error");
+  assert((sutils::split<sutils::policy::reverse>(str, "||", false, 2) == std::vector<std::string>{ "ab||AB", "ab" }) && "error");
+  assert((sutils::cmp<sutils::policy::icase>(std::string("aBc"), "AbC")) && "error");
+  assert((!sutils::cmp<sutils::policy::reverse>(std::string("abc"), "abd")) && "error");
+  assert((sutils::starts<sutils::policy::icase | sutils::policy::reverse>(str, "AB||ab")) && "error");
+  assert((!sutils::starts<sutils::search_policy::none>(std::string("a"), "ab")) && "error");
+  assert((sutils::ends<sutils::policy::icase>(str, "Ab")) && "error");
+  assert((!sutils::ends<sutils::search_policy::none>(std::string(""), "a")) && "error");
+
+  {
+    // the policy names must not make unqualified std names ambiguous
+    using namespace std;
+    using namespace sutils;
+    string letters("abc");
+    reverse(letters.begin(), letters.end());
+    assert((letters == "cba" && find_all<policy::icase | policy::reverse>(str, "AB").size() == 3) && "error");
+  }
+
+#if SUTILS_CPP_VERSION >= 202002L
+  assert((sutils::find_all<"||">(str) == std::vector<size_t>{ 2, 6 }) && "error");
+  assert((sutils::find_all<"ab", sutils::policy::icase>(str, 2) == std::vector<size_t>{ 0, 4 }) && "error");
+  assert((sutils::replace_all<"||">(str, ", ") == "ab, AB, ab") && "error");
+  assert((sutils::split<"||">(str) == std::vector<std::string>{ "ab", "AB", "ab" }) && "error");
+  assert((sutils::split<L"|">(std::wstring(L"a||b"), true) == std::vector<std::wstring>{ L"a", L"", L"b" }) && "error");
+  assert((sutils::cmp<"AB||AB||AB", sutils::policy::icase>(str)) && "error");
+  assert((sutils::starts<"ab|">(str) && sutils::ends<"|AB", sutils::policy::icase>(str)) && "error");
+  assert((!sutils::starts<"">(str) && sutils::starts<"">(std::string()) && !sutils::ends<"ab||AB||ab|">(str)) && "error");
+  assert((sutils::cmp<"BA||BA||BA", sutils::policy::icase | sutils::policy::reverse>(std::string("ba||ba||ba"))) && "error");
+
+  // the fixed length kernels must agree with the runtime length ones, short and long needles,
+  // long haystacks so the pair filter and the skip table kernels are picked too
+  std::mt19937 fixed_rng(3636);
+  for (int round = 0; round < 100; ++round) {
+    std::string text{};
+    for (size_t idx = fixed_rng() % 600; idx > 0; --idx) {
+      text += "abAB|"[fixed_rng() % 5];
+    }
+    if (!text.empty()) {
+      text.insert(fixed_rng() % text.size(), "ab|AB|ab|AB|ab|AB|ab|");
+    }
+
+    const auto check = [&text](auto search){
+      constexpr auto needle = decltype(search)::value;
+      const auto hneedle = needle.view();
+      const std::string plain(hneedle.data(), hneedle.size());
+      assert((sutils::find_all<needle>(text) == sutils::find_all(text, plain)) && "error");
+      assert((sutils::find_all<needle, sutils::policy::icase>(text, 3) == sutils::find_all(text, plain, false, 3, true)) && "error");
+      assert((sutils::find_all<needle, sutils::policy::icase | sutils::policy::reverse>(text) == sutils::find_all(text, plain, true, static_cast<size_t>(-1), true)) && "error");
+      assert((sutils::replace_all<needle, sutils::policy::reverse>(text, "#") == sutils::replace_all(text, plain, "#", true)) && "error");
+      assert((sutils::split<needle, sutils::policy::icase>(text, true) == sutils::split(text, plain, true, false, static_cast<size_t>(-1), true)) && "error");
+      assert((sutils::starts<needle, sutils::policy::icase>(text) == sutils::starts(text, plain, true)) && "error");
+      assert((sutils::ends<needle>(text) == sutils::ends(text, plain)) && "error");
+      assert((sutils::cmp<needle, sutils::policy::icase>(text.substr(0, plain.size())) == sutils::cmp(text.substr(0, plain.size()), plain, true)) && "error");
+    };
+    check(std::integral_constant<sutils::helpers::fixed_string<char, 2>, "|">{});
+    check(std::integral_constant<sutils::helpers::fixed_string<char, 3>, "aB">{});
+    check(std::integral_constant<sutils::helpers::fixed_string<char, 5>, "b|AB">{});
+    check(std::integral_constant<sutils::helpers::fixed_string<char, 9>, "ab|AB|ab">{});
+    check(std::integral_constant<sutils::helpers::fixed_string<char, 22>, "ab|AB|ab|AB|ab|AB|ab|">{});
+  }
+#endif
+
+  // the runtime flags overloads and the policy ones must agree
+  std::mt19937 rng(36);
+  for (int round = 0; round < 300; ++round) {
+    std::string text{};
+    for (size_t idx = rng() % 120; idx > 0; --idx) {
+      text += "abAB|"[rng() % 5];
+    }
+    std::string search{};
+    for (size_t idx = 1 + rng() % 4; idx > 0; --idx) {
+      search += "abAB|"[rng() % 5];
+    }
+    const size_t max_finds = (rng() % 3 == 0) ? rng() % 4 : static_cast<size_t>(-1);
+
+    const auto check = [&](auto policy, bool backward, bool case_insensitive){
+      constexpr auto P = decltype(policy)::value;
+      assert((sutils::find_all<P>(text, search, max_finds) == sutils::find_all(text, search, backward, max_finds, case_insensitive)) && "error");
+      assert((sutils::replace_all<P>(text, search, "#", max_finds) == sutils::replace_all(text, search, "#", backward, max_finds, case_insensitive)) && "error");
+      assert((sutils::split<P>(text, search, true, max_finds) == sutils::split(text, search, true, backward, max_finds, case_insensitive)) && "error");
+      assert((sutils::starts<P>(text, search) == sutils::starts(text, search, case_insensitive)) && "error");
+      assert((sutils::ends<P>(text, search) == sutils::ends(text, search, case_insensitive)) && "error");
+      assert((sutils::cmp<P>(text.substr(0, search.size()), search) == sutils::cmp(text.substr(0, search.size()), search, case_insensitive)) && "error");
+
+      // a naive scan is the reference
+      std::vector<size_t> expected{};
+      const auto len = search.size();
+      if (backward) {
+        for (size_t end = text.size(); end >= len && expected.size() < max_finds; ) {
+          if (sutils::cmp(text.substr(end - len, len), search, case_insensitive)) {
+            expected.emplace_back(end - len);
+            end -= len;
+          } else {
+            --end;
+          }
+        }
+      } else {
+        for (size_t start = 0; start + len <= text.size() && expected.size() < max_finds; ) {
+          if (sutils::cmp(text.substr(start, len), search, case_insensitive)) {
+            expected.emplace_back(start);
+            start += len;
+          } else {
+            ++start;
+          }
+        }
+      }
+      assert((sutils::find_all<P>(text, search, max_finds) == expected) && "error");
+    };
+    check(std::integral_constant<sutils::search_policy, sutils::search_policy::none>{}, false, false);
+    check(std::integral_constant<sutils::search_policy, sutils::policy::icase>{}, false, true);
+    check(std::integral_constant<sutils::search_policy, sutils::policy::reverse>{}, true, false);
+    check(std::integral_constant<sutils::search_policy, sutils::policy::icase | sutils::policy::reverse>{}, true, true);
+  }
+}
+
 int main() {
   auto t1 = std::chrono::high_resolution_clock::now();
   
@@ -335,6 +1294,27 @@ int main() {
   test_find_all();
   test_find_all_backwards();
   test_split();
+  test_small_vector();
+  test_find_all_small();
+  test_split_small();
+  test_search_kernels();
+  test_select_kernel();
+  test_find_all_max_finds();
+  test_split_any();
+  test_lines();
+  test_trim();
+  test_case_conversion();
+  test_collapse_whitespace();
+  test_rolling_hash_searcher();
+  test_needle_searcher();
+  test_searcher_cache();
+  test_piece_buffer();
+  test_match_index();
+  test_join();
+  test_concat();
+  test_intern_pool();
+  test_split_intern();
+  test_search_policy();
 
   auto t2 = std::chrono::high_resolution_clock::now();
   auto d_us = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);